@@ -0,0 +1,3432 @@
+/* Memory manager library
+ *
+ * The placement policies, buddy system, bitmap, variable bookkeeping and
+ * thread-safe front end behind mmanager.h. Everything but the functions
+ * declared there is private to this file.
+ *
+ * Build with -pthread, and with -DMM_STATS to count what managers do.
+ */
+
+#define _DEFAULT_SOURCE		/* MAP_ANONYMOUS under -std=c99 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "mmanager.h"
+
+#define ERROR		MM_ERROR
+#define SUCCESS		MM_SUCCESS
+#define PAGESIZE	4096	/* arena sizes are whole pages */
+#define NBINS		32
+#define MINORDER	4	/* smallest buddy block is 16 bytes */
+#define MAXORDER	32	/* largest arena the buddy system covers */
+#define MT_CACHED	64	/* free blocks a thread keeps per class */
+#define MT_HEADER	16	/* bytes in front of every mt_malloc block,
+				 * and what blocks are aligned to */
+#define MT_MAXARENAS	64
+#define TAG_WORD	sizeof(size_t)	/* a boundary tag */
+#define TAG_START	TAG_WORD	/* offset of the first tagged block */
+#define TAG_MINBLOCK	(4*TAG_WORD)	/* two tags and two free-list links */
+#define TAG_USED	1	/* low bit of a tag, sizes are whole words */
+#define SLAB_SIZE	4096	/* bytes carved into objects of one class */
+#define SLAB_CLASSES	5	/* objects of 8, 16, 32, 64 and 128 bytes */
+#define SLAB_MINSHIFT	3
+#define SLAB_MAXSIZE	((size_t)1 << (SLAB_MINSHIFT+SLAB_CLASSES-1))
+#define SLAB_WORDS	(SLAB_SIZE >> SLAB_MINSHIFT >> 6)
+#define SLAB_ALIGN	64	/* slabs start on a cache line */
+#define ALIGN_UP(off, align)	(((off) + (align)-1) & ~(size_t)((align)-1))
+
+/* build with -DMM_STATS to count what the allocator does. counting
+ * compiles away to nothing otherwise.
+ */
+#ifdef MM_STATS
+#define STATS_BUCKETS	48	/* power of two buckets of cycles */
+#define STAT_ADD(mm, field, n)	((mm)->stats.field += (n))
+#define STAT_MAX(mm, field, v)	((mm)->stats.field < (v) \
+				 ? (void)((mm)->stats.field = (v)) : (void)0)
+#else
+#define STAT_ADD(mm, field, n)	((void)(n))
+#define STAT_MAX(mm, field, v)	((void)0)
+#endif
+
+/* a maximal run of free bytes in mm->memory. Extents are kept on a
+ * doubly linked list in increasing order of offset, so that neighbours
+ * can be merged when a variable is freed.
+ */
+typedef struct {
+	size_t start;		/* offset of the first free byte */
+	size_t len;		/* number of free bytes */
+	int prev, next;		/* neighbouring extents, ERROR at the ends */
+	int bin;		/* size class, see size_class() */
+	int bin_prev, bin_next;	/* other extents of the same size class */
+} extent_t;
+
+/* a slab: SLAB_SIZE bytes of mm->memory cut up into objects of one size
+ * class, see slab_alloc(). slabs with a free object are kept on a doubly
+ * linked list per class.
+ */
+typedef struct {
+	size_t offset;		/* where the slab starts */
+	int class;		/* objects are 8<<class bytes */
+	int used;		/* objects handed out, 0 for a spare record */
+	int prev, next;		/* neighbours on the list, ERROR at the ends */
+	uint64_t free[SLAB_WORDS];	/* set bits are free objects */
+} slab_t;
+
+#ifdef MM_STATS
+/* what a manager has done so far, see stats_report() */
+typedef struct {
+	uint64_t malloc_cycles[STATS_BUCKETS];	/* mm_malloc() timings */
+	uint64_t free_cycles[STATS_BUCKETS];	/* mm_free() timings */
+	uint64_t mallocs, malloc_fails;
+	uint64_t frees, free_fails;
+	uint64_t reallocs, realloc_moves;	/* and how many moved */
+	uint64_t var_selects, var_fails;	/* select_var() */
+	uint64_t selects;	/* select_address() */
+	uint64_t probes;	/* free extents or buddy orders looked at */
+	uint64_t runs, runs_failed;	/* free runs of the bitmap tried */
+	uint64_t scanned;	/* bytes of the bitmap searched */
+	uint64_t vacant_checks, vacant_fails;	/* is_vacant() */
+	uint64_t grows;		/* times memory grew */
+	uint64_t compactions, compact_moved;	/* and bytes moved */
+	uint64_t aligned;	/* allocations aligned to more than a byte */
+	uint64_t align_padding;	/* bytes skipped to align them */
+	size_t live_bytes, peak_bytes;	/* allocated through mm_malloc() */
+	size_t high_end;	/* highest offset ever allocated, plus one */
+} mm_stats_t;
+#endif
+
+/* one manager. it is kept on cache lines of its own, apart from the
+ * memory it hands out, and the counters it only writes come last.
+ */
+struct mmanager {
+	char *memory;		/* totalmem bytes of memory */
+	void *null;		/* first address will be  unusable */
+	void **vars;		/* maxvars variables, each at an address */
+	size_t *var_sizes;	/* number of bytes per variable */
+	unsigned char *var_align;	/* log2 of the alignment of each */
+	size_t totalmem;	/* bytes of memory currently usable */
+	size_t maxmem;		/* bytes reserved, memory may grow up to it */
+	size_t growby;		/* bytes added each time memory grows */
+	int maxvars;		/* number of entries in vars and var_sizes */
+	extent_t *extents;	/* pool of maxvars+1 free-extent records */
+	int free_head;		/* lowest free extent, ERROR if none */
+	int spare_head;		/* unused records, chained through next */
+	int bins[NBINS];	/* free extents segregated by size class */
+	int policy;		/* index into policies[] */
+	int rover;		/* where next-fit resumes, ERROR for the start */
+	int maxorder;		/* totalmem is one buddy block of this order */
+	int buddy_heads[MAXORDER+1];	/* free buddy blocks per order */
+	int *buddy_next;	/* free lists, indexed by offset>>MINORDER */
+	int *buddy_prev;
+	signed char *buddy_free;	/* order of a free block, or ERROR */
+	size_t buddy_requested;	/* bytes asked for by live buddy blocks */
+	size_t buddy_reserved;	/* bytes those blocks actually take up */
+	size_t tag_head;	/* first free tagged block, 0 if none */
+	int *var_slab;		/* slab of each variable, ERROR if it is not
+				 * in one; NULL while slabs are not used */
+	slab_t *slabs;		/* nslabs slab records */
+	int nslabs;
+	int slab_heads[SLAB_CLASSES];	/* slabs with a free object */
+	int slab_spare;		/* unused records, chained through next */
+	size_t nwords;		/* totalmem/64 */
+	uint64_t *occupied;	/* one bit per byte, set when in use */
+	uint64_t *full;		/* one bit per completely used word */
+	int nslotwords;		/* maxvars/64, rounded up */
+	uint64_t *free_slots;	/* set bits are free vars[] */
+	uint64_t *slot_summary;	/* words of free_slots with a bit set */
+	int hash_bits;		/* the lookup has 1<<hash_bits entries */
+	size_t *slot_keys;	/* offsets of live variables, 0 empty */
+	int *slot_vals;		/* their indices into vars[] */
+	int compact_at;		/* percent fragmentation that makes the handle
+				 * functions compact memory, 0 for never */
+	uint64_t *dirty;	/* a bit per page of memory written since it
+				 * was last looked at, NULL if not tracked */
+	uint64_t *dirty_vars;	/* a bit per variable moved, resized or
+				 * freed since, likewise */
+#ifdef MM_STATS
+	mm_stats_t stats;
+#endif
+} __attribute__((aligned(64)));
+
+/* a placement policy picks the free extent a new block is carved from,
+ * returning its index or ERROR if none is long enough.
+ */
+typedef struct {
+	char *name;
+	int (*place)(mmanager_t *mm, size_t size);
+} policy_t;
+
+/* the start of every block mt_malloc() hands out, so that mt_free() can
+ * tell where it came from without a lookup
+ */
+typedef struct {
+	int arena;		/* index into mt_arenas */
+	int class;		/* size class, MT_CLASSES if not cached */
+} mt_header_t;
+
+/* fails to compile unless the header fits in the MT_HEADER bytes kept for
+ * it, which must be a power of two to align blocks to */
+typedef char mt_header_fits[sizeof(mt_header_t) <= MT_HEADER
+			    && !(MT_HEADER & (MT_HEADER-1)) ? 1 : -1];
+
+/* a free block on a cache or remote-free list, linked through itself */
+typedef struct mt_node {
+	struct mt_node *next;
+} mt_node_t;
+
+/* one arena of the thread-safe front end, kept on its own cache lines */
+typedef struct {
+	pthread_mutex_t lock;	/* held while mm is used */
+	mmanager_t mm;
+	mt_node_t *remote;	/* freed by other threads, see mt_free();
+				 * only touched through __atomic builtins */
+} __attribute__((aligned(64))) mt_arena_t;
+
+/* what a thread keeps to itself */
+typedef struct {
+	int arena;		/* the arena it allocates from, or ERROR */
+	int count[MT_CLASSES];	/* blocks on each bin */
+	mt_node_t *bins[MT_CLASSES];	/* recently freed small blocks */
+} mt_cache_t;
+
+/* a variable or slab as manager_compact() sees it */
+typedef struct {
+	size_t offset;		/* where it is, then where it goes */
+	size_t size;		/* bytes it takes up */
+	size_t bytes;		/* bytes of it worth keeping */
+	size_t align;		/* what its offset must be a multiple of */
+	int idx;		/* its index into vars[], ERROR for a slab */
+	int slab;		/* the slab it is, ERROR for a variable */
+} live_t;
+
+static mt_arena_t *mt_arenas;
+static int mt_narenas;
+static int mt_next_arena;	/* hands out arenas to threads in turn */
+static __thread mt_cache_t mt_cache = {.arena = ERROR};
+
+
+/* function prototypes */
+static void *manager_malloc(mmanager_t *mm, size_t size, size_t align);
+static int manager_free(mmanager_t *mm, void *ptr);
+static void *manager_realloc(mmanager_t *mm, void *ptr, size_t size);
+static int claim_after(mmanager_t *mm, size_t start, size_t len);
+static int manager_halloc(mmanager_t *mm, size_t size, size_t align);
+static int manager_hfree(mmanager_t *mm, int h);
+static int manager_hrealloc(mmanager_t *mm, int h, size_t size);
+static int manager_fragmentation(mmanager_t *mm);
+static size_t manager_compact(mmanager_t *mm);
+static int compare_live(const void *a, const void *b);
+static int compare_blocks(const void *a, const void *b);
+static int is_vacant(mmanager_t *mm, void *first, void* last);
+static void *select_address(mmanager_t *mm, size_t size, size_t align);
+static size_t var_span(mmanager_t *mm, int i);
+static int select_var(mmanager_t *mm);
+static void init_vars(mmanager_t *mm);
+static void mark_var(mmanager_t *mm, int idx, int used);
+static void dirty_range(mmanager_t *mm, size_t off, size_t len);
+static void dirty_var(mmanager_t *mm, int idx);
+static int slot_hash(mmanager_t *mm, size_t off);
+static void slot_insert(mmanager_t *mm, size_t off, int idx);
+static int slot_find(mmanager_t *mm, size_t off);
+static int slot_remove(mmanager_t *mm, size_t off);
+static int compare_extents(const void *a, const void *b);
+static int compare_offsets(const void *a, const void *b);
+static int overlapping(extent_t *ranges, int n);
+static void buddy_claim(mmanager_t *mm, size_t off, size_t size);
+static int restore_block(mmanager_t *mm, extent_t *range, size_t off,
+			 size_t size, size_t align);
+static int restore_manager(mmanager_t *mm, size_t *offsets, size_t *sizes,
+			   size_t *aligns, size_t *slabs, size_t *objects,
+			   int n);
+static void init_extents(mmanager_t *mm);
+static int new_extent(mmanager_t *mm, size_t start, size_t len, int prev,
+		      int next);
+static void drop_extent(mmanager_t *mm, int e);
+static void release_address(mmanager_t *mm, void *ptr, size_t size);
+static void set_extent(mmanager_t *mm, int e, size_t start, size_t len);
+static int size_class(size_t len);
+static void bin_extent(mmanager_t *mm, int e);
+static void unbin_extent(mmanager_t *mm, int e);
+static int place_first(mmanager_t *mm, size_t size);
+static int place_next(mmanager_t *mm, size_t size);
+static int place_best(mmanager_t *mm, size_t size);
+static int place_worst(mmanager_t *mm, size_t size);
+static int place_seg(mmanager_t *mm, size_t size);
+static int buddy_order(size_t size);
+static void init_buddy(mmanager_t *mm);
+static void buddy_push(mmanager_t *mm, int u, int order);
+static void buddy_unlink(mmanager_t *mm, int u);
+static void *buddy_alloc(mmanager_t *mm, size_t size);
+static void buddy_release(mmanager_t *mm, void *ptr, size_t size);
+static void buddy_trim(mmanager_t *mm, size_t off, size_t old, size_t size);
+static void buddy_report(mmanager_t *mm, FILE *fp);
+static size_t tag_size(size_t size);
+static size_t tag_get(mmanager_t *mm, size_t off);
+static void tag_set(mmanager_t *mm, size_t off, size_t size, int used);
+static size_t *tag_links(mmanager_t *mm, size_t off);
+static void tag_push(mmanager_t *mm, size_t off, size_t size);
+static void tag_unlink(mmanager_t *mm, size_t off);
+static void init_tags(mmanager_t *mm, size_t start);
+static void *tags_alloc(mmanager_t *mm, size_t size, size_t align);
+static void tags_release(mmanager_t *mm, void *ptr);
+static int tags_resize(mmanager_t *mm, void *ptr, size_t size);
+static void tags_report(mmanager_t *mm, FILE *fp);
+static int tags_restore(mmanager_t *mm, extent_t *ranges, int n);
+static void init_slabs(mmanager_t *mm);
+static int slab_class(size_t size);
+static void slab_push(mmanager_t *mm, int s);
+static void slab_unlink(mmanager_t *mm, int s);
+static int new_slab(mmanager_t *mm, int c);
+static int slab_spares(mmanager_t *mm, int n);
+static int slab_record(mmanager_t *mm, size_t off, int c);
+static void slab_claim(mmanager_t *mm, int s, size_t off, int idx);
+static void *slab_alloc(mmanager_t *mm, size_t size, int idx);
+static void slab_release(mmanager_t *mm, int s, void *ptr);
+static void slab_report(mmanager_t *mm, FILE *fp);
+static int slab_at(mmanager_t *mm, size_t off);
+static void *extent_alloc(mmanager_t *mm, size_t size, size_t align);
+static void rebuild_extents(mmanager_t *mm, extent_t *ranges, int n);
+static void extent_release(mmanager_t *mm, void *ptr, size_t size);
+static void extent_claim(mmanager_t *mm, size_t start, size_t len);
+static void init_bitmap(mmanager_t *mm);
+static void mark_range(mmanager_t *mm, size_t start, size_t len, int used);
+static size_t find_word(const uint64_t *v, size_t from, size_t to,
+			uint64_t pattern);
+static size_t next_clear(mmanager_t *mm, size_t pos);
+static size_t next_set(mmanager_t *mm, size_t pos, size_t end);
+static size_t find_free_run(mmanager_t *mm, size_t size, size_t from,
+			    size_t align);
+static int init_manager(mmanager_t *mm, size_t totalmem, size_t maxmem,
+			size_t growby, int maxvars);
+static int grow_memory(mmanager_t *mm, size_t size);
+static void free_manager(mmanager_t *mm);
+static int mt_class(size_t size);
+static void mt_drain(mt_arena_t *arena);
+static void free_stats(mmanager_t *mm, size_t *total, size_t *largest,
+		       size_t *holes);
+#ifdef MM_STATS
+static uint64_t stats_clock(void);
+static void stats_time(uint64_t *hist, uint64_t t0);
+static void stats_report(mmanager_t *mm, FILE *fp);
+#endif
+
+/* indexed by the MM_POLICY_* constants */
+static policy_t policies[MM_NPOLICIES] = {
+    {"first", place_first},
+    {"next", place_next},
+    {"best", place_best},
+    {"worst", place_worst},
+    {"seg", place_seg},
+    {"buddy", NULL},	/* not extent based, see buddy_alloc() */
+    {"bitmap", NULL},	/* first-fit over the occupancy bitmap */
+    {"tags", NULL}	/* first-fit over boundary-tagged blocks */
+};
+
+
+/****************************************************************/
+
+/* make a manager with totalmem bytes of memory that may grow by growby
+ * bytes at a time up to maxmem, room for maxvars variables, and free space
+ * handed out by policy, see init_manager(). returns NULL if policy is not
+ * one of the MM_POLICY_* constants or we are out of memory.
+ */
+mmanager_t *
+mm_create(int policy, size_t totalmem, size_t maxmem, size_t growby,
+	  int maxvars){
+    mmanager_t *mm;
+
+    if(policy < 0 || policy >= MM_NPOLICIES
+       || posix_memalign((void **)&mm, 64, sizeof(*mm)) != 0){
+	return NULL;
+    }
+    memset(mm, 0, sizeof(*mm));
+    mm->policy = policy;
+    if(init_manager(mm, totalmem, maxmem, growby, maxvars) == ERROR){
+	free(mm);
+	return NULL;
+    }
+    return mm;
+}
+
+
+/****************************************************************/
+
+/* give back everything mm_create() took.
+ */
+void
+mm_destroy(mmanager_t *mm){
+    free_manager(mm);
+    free(mm);
+}
+
+
+/****************************************************************/
+
+/* free every variable of mm at once, keeping its memory as it has grown.
+ */
+void
+mm_reset(mmanager_t *mm){
+    memset(mm->vars, 0, mm->maxvars*sizeof(*mm->vars));
+    memset(mm->var_sizes, 0, mm->maxvars*sizeof(*mm->var_sizes));
+    memset(mm->var_align, 0, mm->maxvars);
+    memset(mm->occupied, 0, mm->nwords*sizeof(uint64_t));
+    memset(mm->full, 0, mm->nwords/64*sizeof(uint64_t));
+    memset(mm->slot_keys, 0, ((size_t)1<<mm->hash_bits)*sizeof(size_t));
+    init_bitmap(mm);
+    init_vars(mm);
+    if(mm->policy == MM_POLICY_BUDDY){
+	init_buddy(mm);
+    } else if(mm->policy == MM_POLICY_TAGS){
+	init_tags(mm, TAG_START);
+    } else {
+	init_extents(mm);
+    }
+    if(mm->var_slab){
+	init_slabs(mm);
+    }
+    if(mm->dirty_vars){
+	memset(mm->dirty_vars, 0xff, (mm->maxvars+63)/64*sizeof(uint64_t));
+    }
+#ifdef MM_STATS
+    mm->stats.live_bytes = 0;
+#endif
+}
+
+
+/****************************************************************/
+
+/* make the handle functions of mm compact memory whenever a free leaves
+ * it percent fragmented, see manager_fragmentation(). 0 turns it off.
+ */
+void
+mm_set_compact(mmanager_t *mm, int percent){
+    mm->compact_at = percent;
+}
+
+
+/****************************************************************/
+
+/* carve variables of up to SLAB_MAXSIZE bytes from slabs of their own
+ * size class, see slab_alloc(), or stop doing so. only call it while mm
+ * has no variables. returns ERROR, leaving slabs off, if we are out of
+ * memory.
+ */
+int
+mm_set_slabs(mmanager_t *mm, int on){
+    if(on && !mm->var_slab){
+	mm->var_slab = mm_new_array(mm->maxvars, sizeof(*mm->var_slab));
+	if(!mm->var_slab){
+	    return ERROR;
+	}
+	init_slabs(mm);
+    } else if(!on){
+	free(mm->var_slab);
+	mm->var_slab = NULL;
+    }
+    return SUCCESS;
+}
+
+
+/****************************************************************/
+
+/* keep track of which pages of memory and which variables of mm change,
+ * for incremental checkpoints, or stop doing so. everything counts as
+ * changed to begin with. mm only sees what it writes itself; what is
+ * written to a variable has to be passed on with mm_touch(). returns
+ * ERROR, keeping no track, if we are out of memory.
+ */
+int
+mm_track_dirty(mmanager_t *mm, int on){
+    size_t words = (mm->maxmem/PAGESIZE+63)/64;
+    if(on && !mm->dirty){
+	mm->dirty = mm_new_array(words, sizeof(uint64_t));
+	mm->dirty_vars = mm_new_array((mm->maxvars+63)/64, sizeof(uint64_t));
+	if(!mm->dirty || !mm->dirty_vars){
+	    mm_track_dirty(mm, 0);
+	    return ERROR;
+	}
+	memset(mm->dirty_vars, 0xff, (mm->maxvars+63)/64*sizeof(uint64_t));
+	dirty_range(mm, 0, mm->totalmem);
+    } else if(!on){
+	free(mm->dirty);
+	free(mm->dirty_vars);
+	mm->dirty = mm->dirty_vars = NULL;
+    }
+    return SUCCESS;
+}
+
+
+/****************************************************************/
+
+/* allocate size bytes from mm, see manager_malloc(). returns NULL if
+ * there is no room.
+ */
+void *
+mm_malloc(mmanager_t *mm, size_t size) {
+    void *start;
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    start = manager_malloc(mm, size, 1);
+    stats_time(mm->stats.malloc_cycles, t0);
+#else
+    start = manager_malloc(mm, size, 1);
+#endif
+    return start == mm->null ? NULL : start;
+}
+
+
+/****************************************************************/
+
+/* allocate size bytes from mm at an address that is a multiple of align,
+ * a power of two no bigger than a page. the variable keeps its alignment
+ * when it is resized or compacted. returns NULL if there is no room or
+ * align is no good.
+ */
+void *
+mm_malloc_aligned(mmanager_t *mm, size_t size, size_t align){
+    void *start;
+    if(align == 0 || align > PAGESIZE || (align & (align-1))){
+	return NULL;
+    }
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    start = manager_malloc(mm, size, align);
+    stats_time(mm->stats.malloc_cycles, t0);
+#else
+    start = manager_malloc(mm, size, align);
+#endif
+    return start == mm->null ? NULL : start;
+}
+
+
+/****************************************************************/
+
+/* free a variable of mm, see manager_free().
+ */
+int
+mm_free(mmanager_t *mm, void *ptr){
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    int done = manager_free(mm, ptr);
+    stats_time(mm->stats.free_cycles, t0);
+    return done;
+#else
+    return manager_free(mm, ptr);
+#endif
+}
+
+
+/****************************************************************/
+
+/* resize a variable of mm, see manager_realloc(). a NULL ptr allocates,
+ * and NULL comes back if there is no room.
+ */
+void *
+mm_realloc(mmanager_t *mm, void *ptr, size_t size){
+    void *start = manager_realloc(mm, ptr ? ptr : mm->null, size);
+    return start == mm->null ? NULL : start;
+}
+
+
+/****************************************************************/
+
+/* allocate size bytes from mm and return a handle to them, see
+ * manager_halloc().
+ */
+int
+mm_halloc(mmanager_t *mm, size_t size) {
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    int h = manager_halloc(mm, size, 1);
+    stats_time(mm->stats.malloc_cycles, t0);
+    return h;
+#else
+    return manager_halloc(mm, size, 1);
+#endif
+}
+
+
+/****************************************************************/
+
+/* like mm_halloc(), but aligned to align, see mm_malloc_aligned().
+ */
+int
+mm_halloc_aligned(mmanager_t *mm, size_t size, size_t align){
+    if(align == 0 || align > PAGESIZE || (align & (align-1))){
+	return ERROR;
+    }
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    int h = manager_halloc(mm, size, align);
+    stats_time(mm->stats.malloc_cycles, t0);
+    return h;
+#else
+    return manager_halloc(mm, size, align);
+#endif
+}
+
+
+/****************************************************************/
+
+/* free the variable of mm that handle h names.
+ */
+int
+mm_hfree(mmanager_t *mm, int h){
+#ifdef MM_STATS
+    uint64_t t0 = stats_clock();
+    int done = manager_hfree(mm, h);
+    stats_time(mm->stats.free_cycles, t0);
+    return done;
+#else
+    return manager_hfree(mm, h);
+#endif
+}
+
+
+/****************************************************************/
+
+/* resize the variable of mm that handle h names.
+ */
+int
+mm_hrealloc(mmanager_t *mm, int h, size_t size){
+    return manager_hrealloc(mm, h, size);
+}
+
+
+/****************************************************************/
+
+/* where the variable handle h names is now. the address is only good
+ * until the next call that may compact memory.
+ */
+void *
+mm_deref(mmanager_t *mm, int h){
+    return mm->vars[h];
+}
+
+
+/****************************************************************/
+
+/* compact mm, see manager_compact().
+ */
+size_t
+mm_compact(mmanager_t *mm){
+    return manager_compact(mm);
+}
+
+
+/****************************************************************/
+
+/* the first byte of the memory of mm, which is never handed out.
+ */
+char *
+mm_memory(mmanager_t *mm){
+    return mm->memory;
+}
+
+
+/****************************************************************/
+
+/* bytes of memory mm can use at the moment.
+ */
+size_t
+mm_size(mmanager_t *mm){
+    return mm->totalmem;
+}
+
+
+/****************************************************************/
+
+/* how many variables mm can hold at once. their indices are handles.
+ */
+int
+mm_maxvars(mmanager_t *mm){
+    return mm->maxvars;
+}
+
+
+/****************************************************************/
+
+/* the size of variable i of mm, 0 if it is free, and where it is in *ptr.
+ */
+size_t
+mm_var(mmanager_t *mm, int i, void **ptr){
+    *ptr = mm->vars[i];
+    return mm->var_sizes[i];
+}
+
+
+/****************************************************************/
+
+/* where the slab that variable i of mm is an object of starts, or 0 if
+ * it is not in one, and how big the objects of that slab are in *object.
+ * mm_restore() wants both back.
+ */
+size_t
+mm_var_slab(mmanager_t *mm, int i, size_t *object){
+    slab_t *slab;
+    *object = 0;
+    if(!mm->var_slab || mm->var_slab[i] == ERROR){
+	return 0;
+    }
+    slab = mm->slabs + mm->var_slab[i];
+    *object = (size_t)1 << (SLAB_MINSHIFT+slab->class);
+    return slab->offset;
+}
+
+
+/****************************************************************/
+
+/* whether mm carves small variables from slabs, see mm_set_slabs().
+ */
+int
+mm_slabs(mmanager_t *mm){
+    return mm->var_slab != NULL;
+}
+
+
+/****************************************************************/
+
+/* the name of the placement policy of mm.
+ */
+char *
+mm_policy_name(mmanager_t *mm){
+    return policies[mm->policy].name;
+}
+
+
+/****************************************************************/
+
+/* add at least size bytes to the memory of mm, see grow_memory().
+ */
+int
+mm_grow(mmanager_t *mm, size_t size){
+    return grow_memory(mm, size);
+}
+
+
+/****************************************************************/
+
+/* put back variables whose bytes are already in the memory of a fresh
+ * mm, see restore_manager(). aligns may be NULL if none was asked for,
+ * and slabs and objects if none of them is in a slab.
+ */
+int
+mm_restore(mmanager_t *mm, size_t *offsets, size_t *sizes, size_t *aligns,
+	   size_t *slabs, size_t *objects, int n){
+    return restore_manager(mm, offsets, sizes, aligns, slabs, objects, n);
+}
+
+
+/****************************************************************/
+
+/* note that len bytes from ptr, in memory of mm, have been written, see
+ * mm_track_dirty().
+ */
+void
+mm_touch(mmanager_t *mm, void *ptr, size_t len){
+    dirty_range(mm, (char *)ptr - mm->memory, len);
+}
+
+
+/****************************************************************/
+
+/* the first run of changed pages of mm at or after offset *offset, which
+ * is moved to its start. returns its length in bytes, 0 if there is none,
+ * and counts it as unchanged from then on.
+ */
+size_t
+mm_next_dirty(mmanager_t *mm, size_t *offset){
+    size_t page = *offset/PAGESIZE, end = mm->totalmem/PAGESIZE, last;
+
+    if(!mm->dirty){
+	return 0;
+    }
+    while(page < end && !(mm->dirty[page>>6] >> (page&63) & 1)){
+	page = mm->dirty[page>>6] >> (page&63) ? page+1 : (page|63)+1;
+    }
+    for(last = page; last < end && mm->dirty[last>>6] >> (last&63) & 1;
+	last++){
+	mm->dirty[last>>6] &= ~((uint64_t)1 << (last&63));
+    }
+    *offset = page*PAGESIZE;
+    return (last-page)*PAGESIZE;
+}
+
+
+/****************************************************************/
+
+/* the first variable of mm at or after index i that has changed, which
+ * counts as unchanged from then on, or ERROR if there is none.
+ */
+int
+mm_next_dirty_var(mmanager_t *mm, int i){
+    for(; mm->dirty_vars && i<mm->maxvars; i++){
+	if(!(mm->dirty_vars[i>>6] >> (i&63))){
+	    i |= 63;
+	} else if(mm->dirty_vars[i>>6] >> (i&63) & 1){
+	    mm->dirty_vars[i>>6] &= ~((uint64_t)1 << (i&63));
+	    return i;
+	}
+    }
+    return ERROR;
+}
+
+
+/****************************************************************/
+
+/* how free space in mm is broken up, see free_stats().
+ */
+void
+mm_free_stats(mmanager_t *mm, size_t *total, size_t *largest, size_t *holes){
+    free_stats(mm, total, largest, holes);
+}
+
+
+/****************************************************************/
+
+/* report on how well the policy of mm has used its memory, which only
+ * the buddy system and boundary tags have anything to say about, and on
+ * the slabs, if it uses them.
+ */
+void
+mm_report(mmanager_t *mm, FILE *fp){
+    if(mm->policy == MM_POLICY_BUDDY){
+	buddy_report(mm, fp);
+    } else if(mm->policy == MM_POLICY_TAGS){
+	tags_report(mm, fp);
+    }
+    if(mm->var_slab){
+	slab_report(mm, fp);
+    }
+}
+
+
+/****************************************************************/
+
+/* print what mm has counted so far, when built with -DMM_STATS.
+ */
+void
+mm_stats_report(mmanager_t *mm, FILE *fp){
+#ifdef MM_STATS
+    stats_report(mm, fp);
+#else
+    (void)mm;
+    (void)fp;
+#endif
+}
+
+
+/****************************************************************/
+
+/* perform the similar task to what malloc funtion does.
+ * allocate a requested memory using several functions and return the address.
+ * the address is a multiple of align, a power of two.
+ * if it fails, returns mm->null 
+ */
+static void *
+manager_malloc(mmanager_t *mm, size_t size, size_t align) {
+    int idx;
+    void* start;
+
+    STAT_ADD(mm, mallocs, 1);
+    STAT_ADD(mm, aligned, align > 1);
+    idx = select_var(mm);
+	
+    if(idx == ERROR){
+	STAT_ADD(mm, malloc_fails, 1);
+	return mm->null;
+    }
+
+    /* objects are aligned to their size class, up to SLAB_ALIGN */
+    if(mm->var_slab && size <= SLAB_MAXSIZE && align <= SLAB_ALIGN){
+	start = slab_alloc(mm, size < align ? align : size, idx);
+    } else {
+	start = select_address(mm, size, align);
+    }
+	
+    if (start == mm->null){
+	STAT_ADD(mm, malloc_fails, 1);
+	return mm->null;
+    }
+    STAT_ADD(mm, live_bytes, size);
+    STAT_MAX(mm, peak_bytes, mm->stats.live_bytes);
+    STAT_MAX(mm, high_end, (size_t)((char *)start+size - mm->memory));
+    
+    /* all conditions satisfied. allocate memory. */	
+    mm->var_sizes[idx] = size;
+    mm->var_align[idx] = __builtin_ctzll(align);
+    mm->vars[idx] = start;
+    mark_var(mm, idx, 1);
+    dirty_var(mm, idx);
+    slot_insert(mm, (char *)start - mm->memory, idx);
+    return start;
+}
+
+/****************************************************************/
+
+/* check if the address ptr has been allocated as the start of an allocated 
+ * block and free it by updating mm->vars and mm->var_sizes.
+ * the bytes it occupied are handed back to the free space. returns ERROR
+ * if ptr is not the start of an allocated block, SUCCESS otherwise.
+ */
+static int
+manager_free(mmanager_t *mm, void *ptr){
+    int i;
+    STAT_ADD(mm, frees, 1);
+    if((char *)ptr <= mm->memory || (char *)ptr >= mm->memory+mm->totalmem
+       || (i = slot_remove(mm, (char *)ptr - mm->memory)) == ERROR){
+	STAT_ADD(mm, free_fails, 1);
+	return ERROR;
+    }
+    STAT_ADD(mm, live_bytes, -mm->var_sizes[i]);
+    if(mm->var_slab && mm->var_slab[i] != ERROR){
+	slab_release(mm, mm->var_slab[i], ptr);
+	mm->var_slab[i] = ERROR;
+    } else {
+	release_address(mm, ptr, var_span(mm, i));
+    }
+    mm->vars[i] = mm->null;
+    mm->var_sizes[i] = 0;
+    mark_var(mm, i, 0);
+    dirty_var(mm, i);
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* change the size of the variable at ptr to size bytes, keeping its index
+ * into mm->vars and as much of its contents as fit. it shrinks in place,
+ * grows in place when the bytes after it are free, and is only moved when
+ * they are not. an object in a slab only moves when it outgrows its size
+ * class. returns where it now is, or mm->null, with nothing
+ * changed, if ptr is not a variable or there is no room.
+ */
+static void *
+manager_realloc(mmanager_t *mm, void *ptr, size_t size){
+    size_t off = (char *)ptr - mm->memory, old, align, span, want;
+    char *start;
+    int i, slab = ERROR, to_slab;
+
+    if(ptr == mm->null){
+	return manager_malloc(mm, size, 1);
+    }
+    if((char *)ptr < mm->memory || (char *)ptr >= mm->memory+mm->totalmem
+       || (i = slot_find(mm, off)) == ERROR || size == 0){
+	return mm->null;
+    }
+    old = mm->var_sizes[i];
+    STAT_ADD(mm, reallocs, 1);
+    if(mm->var_slab){
+	slab = mm->var_slab[i];
+    }
+
+    /* the buddy system gives a variable a block at least as big as its
+     * alignment, see var_span()
+     */
+    align = (size_t)1 << mm->var_align[i];
+    span = var_span(mm, i);
+    want = mm->policy == MM_POLICY_BUDDY && size < align ? align : size;
+    to_slab = mm->var_slab && size <= SLAB_MAXSIZE && align <= SLAB_ALIGN;
+
+    if(slab != ERROR
+       && size <= (size_t)1 << (SLAB_MINSHIFT+mm->slabs[slab].class)){
+	/* an object stays in its slab while it fits its size class */
+    } else if(slab == ERROR && mm->policy == MM_POLICY_BUDDY
+	      && buddy_order(want) <= buddy_order(span)){
+	/* a buddy block can shrink, but only grow within its own order */
+	buddy_trim(mm, off, span, want);
+	mark_range(mm, off + (size < old ? size : old),
+		   size < old ? old-size : size-old, size > old);
+    } else if(slab == ERROR && mm->policy == MM_POLICY_TAGS
+	      && tags_resize(mm, ptr, size) == SUCCESS){
+	/* the tags say at once whether the next block can be taken in */
+	mark_range(mm, off + (size < old ? size : old),
+		   size < old ? old-size : size-old, size > old);
+    } else if(slab == ERROR && mm->policy != MM_POLICY_BUDDY && size < old){
+	release_address(mm, (char *)ptr + size, old-size);
+    } else if(slab != ERROR || mm->policy == MM_POLICY_BUDDY
+	      || mm->policy == MM_POLICY_TAGS
+	      || (size > old && claim_after(mm, off+old, size-old) == ERROR)){
+	start = to_slab ? slab_alloc(mm, size < align ? align : size, i)
+	    : select_address(mm, size, align);
+	if(start == mm->null){
+	    return mm->null;
+	}
+	STAT_ADD(mm, realloc_moves, 1);
+	memcpy(start, ptr, size < old ? size : old);
+	dirty_range(mm, start - mm->memory, size < old ? size : old);
+	if(slab != ERROR){
+	    slab_release(mm, slab, ptr);
+	} else {
+	    release_address(mm, ptr, span);
+	}
+	if(mm->var_slab && !to_slab){
+	    mm->var_slab[i] = ERROR;
+	}
+	slot_remove(mm, off);
+	slot_insert(mm, start - mm->memory, i);
+	mm->vars[i] = ptr = start;
+    }
+    mm->var_sizes[i] = size;
+    dirty_var(mm, i);
+    STAT_ADD(mm, live_bytes, size-old);
+    STAT_MAX(mm, peak_bytes, mm->stats.live_bytes);
+    STAT_MAX(mm, high_end, (size_t)((char *)ptr+size - mm->memory));
+    return ptr;
+}
+
+/****************************************************************/
+
+/* take the len bytes from offset start, just past the end of a variable,
+ * if they are all free, growing memory when they run past its end.
+ * returns ERROR if any of them is in use or memory cannot grow enough.
+ */
+static int
+claim_after(mmanager_t *mm, size_t start, size_t len){
+    size_t end = start+len;
+    size_t stop = end < mm->totalmem ? end : mm->totalmem;
+
+    if(stop > start && !is_vacant(mm, mm->memory+start, mm->memory+stop-1)){
+	return ERROR;
+    }
+    while(end > mm->totalmem
+	  && grow_memory(mm, end - mm->totalmem) == SUCCESS);
+    if(end > mm->totalmem){
+	return ERROR;
+    }
+    mark_range(mm, start, len, 1);
+    if(mm->policy != MM_POLICY_BITMAP){
+	extent_claim(mm, start, len);
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* like manager_malloc(), but return the index into mm->vars of the new
+ * variable, which stays the same when the variable is moved, or ERROR.
+ * when there is no room and mm->compact_at is set, memory is compacted
+ * and the allocation tried once more.
+ */
+static int
+manager_halloc(mmanager_t *mm, size_t size, size_t align){
+    char *start = manager_malloc(mm, size, align);
+    if(start == mm->null && mm->compact_at > 0){
+	manager_compact(mm);
+	start = manager_malloc(mm, size, align);
+    }
+    return start == mm->null ? ERROR : slot_find(mm, start - mm->memory);
+}
+
+/****************************************************************/
+
+/* free the variable handle h names. returns ERROR if it names none.
+ * memory is compacted once fragmentation reaches mm->compact_at percent.
+ */
+static int
+manager_hfree(mmanager_t *mm, int h){
+    if(h < 0 || h >= mm->maxvars || mm->var_sizes[h] == 0
+       || manager_free(mm, mm->vars[h]) == ERROR){
+	return ERROR;
+    }
+    if(mm->compact_at > 0 && manager_fragmentation(mm) >= mm->compact_at){
+	manager_compact(mm);
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* resize the variable handle h names, see manager_realloc(), compacting
+ * memory and trying again if there is no room and mm->compact_at is set.
+ * returns ERROR, with the variable unchanged, if that fails.
+ */
+static int
+manager_hrealloc(mmanager_t *mm, int h, size_t size){
+    if(h < 0 || h >= mm->maxvars || mm->var_sizes[h] == 0){
+	return ERROR;
+    }
+    if(manager_realloc(mm, mm->vars[h], size) != mm->null){
+	return SUCCESS;
+    }
+    if(mm->compact_at == 0){
+	return ERROR;
+    }
+    manager_compact(mm);
+    return manager_realloc(mm, mm->vars[h], size) != mm->null
+	? SUCCESS : ERROR;
+}
+
+/****************************************************************/
+
+/* how fragmented free space is, in percent: 100 less the share of it in
+ * the largest free block.
+ */
+static int
+manager_fragmentation(mmanager_t *mm){
+    size_t total, largest, holes;
+    free_stats(mm, &total, &largest, &holes);
+    return total ? (int)(100 - 100*largest/total) : 0;
+}
+
+/****************************************************************/
+
+/* slide every variable down towards offset 1, in address order, so that
+ * all free space ends up in one block at the end of memory, but for what
+ * is left in front of variables to keep them aligned. variables keep
+ * their indexes, so handles stay good but addresses do not. tagged
+ * blocks slide down from TAG_START, tags and all, and slabs move as a
+ * whole, taking their objects with them. the buddy system instead packs
+ * blocks down from the top of memory, largest first, so that each stays
+ * aligned to its own size. returns the number of bytes moved, 0 if we are
+ * out of memory to do it with.
+ */
+static size_t
+manager_compact(mmanager_t *mm){
+    live_t *live = mm_new_array(mm->maxvars + mm->nslabs, sizeof(*live));
+    extent_t *ranges = mm_new_array(mm->maxvars + mm->nslabs,
+				    sizeof(*ranges));
+    char *scratch = NULL;
+    size_t pos = 1, moved = 0, size;
+    int n = 0, i, k, s;
+
+    if(!live || !ranges){
+	free(live);
+	free(ranges);
+	return 0;
+    }
+    for(i = 0; i<mm->maxvars; i++){
+	if(mm->var_sizes[i] > 0
+	   && (!mm->var_slab || mm->var_slab[i] == ERROR)){
+	    live[n].offset = (char *)mm->vars[i] - mm->memory;
+	    live[n].bytes = mm->var_sizes[i];
+	    live[n].align = (size_t)1 << mm->var_align[i];
+	    live[n].size = mm->policy == MM_POLICY_BUDDY
+		? (size_t)1<<buddy_order(var_span(mm, i)) : live[n].bytes;
+	    live[n].slab = ERROR;
+	    live[n++].idx = i;
+	}
+    }
+    for(s = 0; mm->var_slab && s<mm->nslabs; s++){
+	if(mm->slabs[s].used > 0){
+	    live[n].offset = mm->slabs[s].offset;
+	    live[n].size = live[n].bytes = SLAB_SIZE;
+	    live[n].align = SLAB_ALIGN;
+	    live[n].idx = ERROR;
+	    live[n++].slab = s;
+	}
+    }
+    if(mm->policy == MM_POLICY_TAGS){
+	for(k = 0; k<n; k++){
+	    live[k].offset -= TAG_WORD;
+	    live[k].size = tag_get(mm, live[k].offset) & ~(size_t)TAG_USED;
+	}
+	pos = TAG_START;
+    }
+    if(mm->policy == MM_POLICY_BUDDY){
+	/* blocks may land on each other, so they are copied out first */
+	for(k = 0, size = 0; k<n; k++){
+	    size += live[k].bytes;
+	}
+	if(!(scratch = mm_new_array(size, 1))){
+	    free(live);
+	    free(ranges);
+	    return 0;
+	}
+    }
+    for(i = 0; mm->var_slab && i<mm->maxvars; i++){
+	if(mm->var_slab[i] != ERROR){
+	    /* for now, where the object is within its slab */
+	    s = mm->var_slab[i];
+	    mm->vars[i] = (char *)mm->vars[i] - mm->slabs[s].offset;
+	}
+    }
+
+    if(mm->policy == MM_POLICY_BUDDY){
+	qsort(live, n, sizeof(*live), compare_blocks);
+	for(k = 0, size = 0; k<n; k++){
+	    memcpy(scratch+size, mm->memory+live[k].offset, live[k].bytes);
+	    size += live[k].bytes;
+	}
+	for(k = 0, size = 0, pos = mm->totalmem; k<n; k++){
+	    pos -= live[k].size;
+	    if(live[k].offset != pos){
+		memcpy(mm->memory+pos, scratch+size, live[k].bytes);
+		dirty_range(mm, pos, live[k].bytes);
+		moved += live[k].bytes;
+	    }
+	    live[k].offset = pos;
+	    size += live[k].bytes;
+	}
+	free(scratch);
+    } else {
+	qsort(live, n, sizeof(*live), compare_live);
+	for(k = 0; k<n; k++){
+	    /* never past where it is, which is aligned already */
+	    if(mm->policy == MM_POLICY_TAGS){
+		pos = ALIGN_UP(pos + TAG_WORD, live[k].align) - TAG_WORD;
+		while(k == 0 && pos > TAG_START
+		      && pos - TAG_START < TAG_MINBLOCK){
+		    pos += live[k].align;
+		}
+	    } else {
+		pos = ALIGN_UP(pos, live[k].align);
+	    }
+	    if(live[k].offset != pos){
+		memmove(mm->memory+pos, mm->memory+live[k].offset,
+			live[k].size);
+		dirty_range(mm, pos, live[k].size);
+		moved += live[k].size;
+	    }
+	    live[k].offset = pos;
+	    pos += live[k].size;
+	}
+    }
+
+    /* every structure that knows where variables are starts over. the
+     * gaps left for alignment become free space again; tags fold those
+     * too small to be a block into the block before them.
+     */
+    memset(mm->slot_keys, 0, sizeof(*mm->slot_keys) << mm->hash_bits);
+    mark_range(mm, 1, mm->totalmem-1, 0);
+    if(mm->policy == MM_POLICY_BUDDY){
+	init_buddy(mm);
+    } else if(mm->policy != MM_POLICY_BITMAP){
+	for(k = 0; k<n; k++){
+	    ranges[k].start = live[k].offset;
+	    ranges[k].len = live[k].size;
+	}
+	if(mm->policy == MM_POLICY_TAGS){
+	    tags_restore(mm, ranges, n);
+	} else {
+	    rebuild_extents(mm, ranges, n);
+	}
+    }
+    for(k = 0; k<n; k++){
+	if(mm->policy == MM_POLICY_TAGS){
+	    live[k].offset += TAG_WORD;
+	}
+	mark_range(mm, live[k].offset, live[k].bytes, 1);
+	if(mm->policy == MM_POLICY_BUDDY){
+	    buddy_claim(mm, live[k].offset, live[k].slab == ERROR
+			? var_span(mm, live[k].idx) : SLAB_SIZE);
+	}
+	if(live[k].slab != ERROR){
+	    mm->slabs[live[k].slab].offset = live[k].offset;
+	    continue;
+	}
+	i = live[k].idx;
+	mm->vars[i] = mm->memory + live[k].offset;
+	slot_insert(mm, live[k].offset, i);
+	dirty_var(mm, i);
+    }
+    for(i = 0; mm->var_slab && i<mm->maxvars; i++){
+	if(mm->var_slab[i] != ERROR){
+	    s = mm->var_slab[i];
+	    mm->vars[i] = (char *)mm->vars[i] + mm->slabs[s].offset;
+	    slot_insert(mm, (char *)mm->vars[i] - mm->memory, i);
+	    dirty_var(mm, i);
+	}
+    }
+    STAT_ADD(mm, compactions, 1);
+    STAT_ADD(mm, compact_moved, moved);
+    free(live);
+    free(ranges);
+    return moved;
+}
+
+/****************************************************************/
+
+/* order variables by offset, for qsort().
+ */
+static int
+compare_live(const void *a, const void *b){
+    const live_t *x = a, *y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/****************************************************************/
+
+/* order variables largest first, then by offset, for qsort().
+ */
+static int
+compare_blocks(const void *a, const void *b){
+    const live_t *x = a, *y = b;
+    if(x->size != y->size){
+	return x->size > y->size ? -1 : 1;
+    }
+    return compare_live(a, b);
+}
+
+/****************************************************************/
+
+/* get two pointer arguments, which indicate the first and the last address 
+ * respectively, and check if the memory between the addresses are valid.
+ * the occupancy bitmap is checked a word (or a vector of words) at a time.
+ */
+static int
+is_vacant(mmanager_t *mm, void *first, void *last){
+    size_t first_off = (char *)first - mm->memory;
+    size_t end = (char *)last - mm->memory + 1;
+
+    STAT_ADD(mm, vacant_checks, 1);
+    if(next_set(mm, first_off, end) != end){
+	STAT_ADD(mm, vacant_fails, 1);
+	return 0;
+    }
+    return 1;
+}
+
+/****************************************************************/
+
+/* select an available address which can accommodate the passed size, using
+ * the current placement policy, and mark those bytes as used. the address
+ * is a multiple of align, and any bytes skipped to get there stay free.
+ * memory is grown, up to mm->maxmem, when nothing fits.
+ */
+static void *
+select_address(mmanager_t *mm, size_t size, size_t align){
+    char *start;
+    size_t off;
+
+    STAT_ADD(mm, selects, 1);
+    do {
+	if(mm->policy == MM_POLICY_BUDDY){
+	    /* blocks are aligned to their own size */
+	    start = buddy_alloc(mm, size < align ? align : size);
+	    STAT_ADD(mm, align_padding, start == mm->null || size >= align
+		     ? 0 : ((size_t)1<<buddy_order(align))
+		     - ((size_t)1<<buddy_order(size)));
+	} else if(mm->policy == MM_POLICY_BITMAP){
+	    off = find_free_run(mm, size, 1, align);
+	    start = off < mm->totalmem ? mm->memory + off : mm->null;
+	} else if(mm->policy == MM_POLICY_TAGS){
+	    start = tags_alloc(mm, size, align);
+	} else {
+	    start = extent_alloc(mm, size, align);
+	}
+    } while(start == mm->null
+	    && grow_memory(mm, size + align-1) == SUCCESS);
+    if(start != mm->null){
+	mark_range(mm, start - mm->memory, size, 1);
+    }
+    return start;
+}
+
+/****************************************************************/
+
+/* the bytes select_address() was asked for variable i: its size, or in
+ * the buddy system its alignment when that is bigger.
+ */
+static size_t
+var_span(mmanager_t *mm, int i){
+    size_t align = (size_t)1 << mm->var_align[i];
+    return mm->policy == MM_POLICY_BUDDY && mm->var_sizes[i] < align
+	? align : mm->var_sizes[i];
+}
+
+/****************************************************************/
+
+/* carve size bytes from the front of the free extent the placement policy
+ * picks, returning mm->null if there is none. for an aligned request the
+ * bytes in front of the first aligned offset stay behind as a free extent
+ * of their own. if the extent picked for size bytes is too short once
+ * aligned, the policy is asked again for room for the worst padding.
+ */
+static void *
+extent_alloc(mmanager_t *mm, size_t size, size_t align){
+    int e = policies[mm->policy].place(mm, size);
+    extent_t *ext;
+    size_t start, end;
+
+    if(e != ERROR && ALIGN_UP(mm->extents[e].start, align) + size
+       > mm->extents[e].start + mm->extents[e].len){
+	e = policies[mm->policy].place(mm, size + align-1);
+    }
+    if(e == ERROR){
+	return mm->null;
+    }
+    ext = mm->extents + e;
+    start = ALIGN_UP(ext->start, align);
+    end = ext->start + ext->len;
+
+    /* next-fit resumes here; dropping the extent moves the rover on */
+    mm->rover = e;
+    if(start > ext->start){
+	STAT_ADD(mm, align_padding, start - ext->start);
+	if(end > start + size){
+	    new_extent(mm, start + size, end - start - size, e, ext->next);
+	}
+	set_extent(mm, e, ext->start, start - ext->start);
+    } else if(ext->len == size){
+	drop_extent(mm, e);
+    } else {
+	set_extent(mm, e, ext->start + size, ext->len - size);
+    }
+    return mm->memory + start;
+}
+
+/****************************************************************/
+
+/* first-fit: the lowest extent that is long enough. Free extents are
+ * maximal runs of vacant bytes, so its start is exactly the lowest offset
+ * a byte-by-byte scan of mm->memory would have found.
+ */
+static int
+place_first(mmanager_t *mm, size_t size){
+    int e;
+    for(e = mm->free_head; e != ERROR; e = mm->extents[e].next){
+	STAT_ADD(mm, probes, 1);
+	if(mm->extents[e].len >= size){
+	    return e;
+	}
+    }
+    return ERROR;
+}
+
+/****************************************************************/
+
+/* next-fit: like first-fit, but start from where the previous search
+ * stopped and wrap around to the lowest extent.
+ */
+static int
+place_next(mmanager_t *mm, size_t size){
+    int e, start = mm->rover;
+    if(start == ERROR){
+	start = mm->free_head;
+    }
+    for(e = start; e != ERROR; e = mm->extents[e].next){
+	STAT_ADD(mm, probes, 1);
+	if(mm->extents[e].len >= size){
+	    return e;
+	}
+    }
+    for(e = mm->free_head; e != start; e = mm->extents[e].next){
+	STAT_ADD(mm, probes, 1);
+	if(mm->extents[e].len >= size){
+	    return e;
+	}
+    }
+    return ERROR;
+}
+
+/****************************************************************/
+
+/* best-fit: the shortest extent that is long enough, lowest on ties.
+ */
+static int
+place_best(mmanager_t *mm, size_t size){
+    int e, best = ERROR;
+    for(e = mm->free_head; e != ERROR; e = mm->extents[e].next){
+	STAT_ADD(mm, probes, 1);
+	if(mm->extents[e].len >= size && (best == ERROR
+	   || mm->extents[e].len < mm->extents[best].len)){
+	    best = e;
+	    if(mm->extents[e].len == size){
+		break;
+	    }
+	}
+    }
+    return best;
+}
+
+/****************************************************************/
+
+/* worst-fit: the longest extent, lowest on ties.
+ */
+static int
+place_worst(mmanager_t *mm, size_t size){
+    int e, worst = ERROR;
+    for(e = mm->free_head; e != ERROR; e = mm->extents[e].next){
+	STAT_ADD(mm, probes, 1);
+	if(worst == ERROR || mm->extents[e].len > mm->extents[worst].len){
+	    worst = e;
+	}
+    }
+    if(worst != ERROR && mm->extents[worst].len < size){
+	return ERROR;
+    }
+    return worst;
+}
+
+/****************************************************************/
+
+/* segregated fit: look through the bin of the requested size class for an
+ * extent that is long enough, then take any extent from a larger class.
+ */
+static int
+place_seg(mmanager_t *mm, size_t size){
+    int b = size_class(size), e;
+    for(e = mm->bins[b]; e != ERROR; e = mm->extents[e].bin_next){
+	STAT_ADD(mm, probes, 1);
+	if(mm->extents[e].len >= size){
+	    return e;
+	}
+    }
+    for(b++; b<NBINS; b++){
+	STAT_ADD(mm, probes, 1);
+	if(mm->bins[b] != ERROR){
+	    return mm->bins[b];
+	}
+    }
+    return ERROR;
+}
+
+/****************************************************************/
+
+/* look up a placement policy by name, returning its index or ERROR.
+ */
+int
+mm_find_policy(char *name){
+    int p;
+    for(p = 0; p<MM_NPOLICIES; p++){
+	if(strcmp(name, policies[p].name) == 0){
+	    return p;
+	}
+    }
+    return ERROR;
+}
+
+/****************************************************************/
+
+/* select the earliest available index into mm->vars which is not assigned.
+ * the lowest set bit of the free-slot summary names the first word of
+ * free_slots with a free index in it.
+ */
+static int 
+select_var(mmanager_t *mm){
+    int s, n = (mm->nslotwords+63)>>6, w;
+    STAT_ADD(mm, var_selects, 1);
+    s = find_word(mm->slot_summary, 0, n, 0);
+    if(s == n){
+	STAT_ADD(mm, var_fails, 1);
+	return ERROR;
+    }
+    w = (s<<6) + __builtin_ctzll(mm->slot_summary[s]);
+    return (w<<6) + __builtin_ctzll(mm->free_slots[w]);
+}
+
+/****************************************************************/
+
+/* set up the variable bookkeeping: every index into mm->vars is free
+ * and no offset is known to the lookup table. the bits past maxvars in
+ * the last word of free_slots stay clear, so they are never handed out.
+ */
+static void
+init_vars(mmanager_t *mm){
+    int w;
+    for(w = 0; w<mm->nslotwords; w++){
+	mm->free_slots[w] = ~(uint64_t)0;
+	mm->slot_summary[w>>6] |= (uint64_t)1 << (w&63);
+    }
+    if(mm->maxvars & 63){
+	mm->free_slots[w-1] = ((uint64_t)1 << (mm->maxvars&63)) - 1;
+    }
+}
+
+/****************************************************************/
+
+/* mark index idx of mm->vars as taken (used != 0) or free again.
+ */
+static void
+mark_var(mmanager_t *mm, int idx, int used){
+    int w = idx>>6;
+    if(used){
+	mm->free_slots[w] &= ~((uint64_t)1 << (idx&63));
+	if(mm->free_slots[w] == 0){
+	    mm->slot_summary[w>>6] &= ~((uint64_t)1 << (w&63));
+	}
+    } else {
+	mm->free_slots[w] |= (uint64_t)1 << (idx&63);
+	mm->slot_summary[w>>6] |= (uint64_t)1 << (w&63);
+    }
+}
+
+/****************************************************************/
+
+/* note that len bytes of memory from offset off have changed, if mm
+ * keeps track, see mm_track_dirty().
+ */
+static void
+dirty_range(mmanager_t *mm, size_t off, size_t len){
+    size_t page;
+    if(!mm->dirty || len == 0){
+	return;
+    }
+    for(page = off/PAGESIZE; page <= (off+len-1)/PAGESIZE; page++){
+	mm->dirty[page>>6] |= (uint64_t)1 << (page&63);
+    }
+}
+
+/****************************************************************/
+
+/* note that variable idx has changed, likewise.
+ */
+static void
+dirty_var(mmanager_t *mm, int idx){
+    if(mm->dirty_vars){
+	mm->dirty_vars[idx>>6] |= (uint64_t)1 << (idx&63);
+    }
+}
+
+/****************************************************************/
+
+/* home position of an offset in the lookup table (Fibonacci hashing).
+ */
+static int
+slot_hash(mmanager_t *mm, size_t off){
+    return (int)(((uint64_t)off * 0x9E3779B97F4A7C15ULL)
+		 >> (64-mm->hash_bits));
+}
+
+/****************************************************************/
+
+/* remember that the variable starting at offset off lives in index idx.
+ * offset 0 is our own NULL, so a key of 0 marks an empty table entry.
+ */
+static void
+slot_insert(mmanager_t *mm, size_t off, int idx){
+    int h = slot_hash(mm, off), mask = (1<<mm->hash_bits) - 1;
+    while(mm->slot_keys[h] != 0){
+	h = (h+1) & mask;
+    }
+    mm->slot_keys[h] = off;
+    mm->slot_vals[h] = idx;
+}
+
+/****************************************************************/
+
+/* the index into mm->vars of the variable starting at offset off, or
+ * ERROR if no variable starts there.
+ */
+static int
+slot_find(mmanager_t *mm, size_t off){
+    int h = slot_hash(mm, off), mask = (1<<mm->hash_bits) - 1;
+    while(mm->slot_keys[h] != off){
+	if(mm->slot_keys[h] == 0){
+	    return ERROR;
+	}
+	h = (h+1) & mask;
+    }
+    return mm->slot_vals[h];
+}
+
+/****************************************************************/
+
+/* forget the variable starting at offset off and return its index into
+ * mm->vars, or ERROR if no variable starts there. Later entries of
+ * the probe run are shifted back so lookups never need tombstones.
+ */
+static int
+slot_remove(mmanager_t *mm, size_t off){
+    int h = slot_hash(mm, off), idx, next, home;
+    int mask = (1<<mm->hash_bits) - 1;
+    while(mm->slot_keys[h] != off){
+	if(mm->slot_keys[h] == 0){
+	    return ERROR;
+	}
+	h = (h+1) & mask;
+    }
+    idx = mm->slot_vals[h];
+    for(next = (h+1) & mask; mm->slot_keys[next] != 0;
+	next = (next+1) & mask){
+	home = slot_hash(mm, mm->slot_keys[next]);
+	/* move the entry back unless its home lies in (h, next] */
+	if(((next-home) & mask) >= ((next-h) & mask)){
+	    mm->slot_keys[h] = mm->slot_keys[next];
+	    mm->slot_vals[h] = mm->slot_vals[next];
+	    h = next;
+	}
+    }
+    mm->slot_keys[h] = 0;
+    return idx;
+}
+
+/****************************************************************/
+
+/* set up the free-extent list: every byte but the unusable first one is
+ * free, and all other records are chained together as spares.
+ */
+static void
+init_extents(mmanager_t *mm){
+    int e;
+    for(e = 0; e<=mm->maxvars; e++){
+	mm->extents[e].next = e < mm->maxvars ? e+1 : ERROR;
+    }
+    for(e = 0; e<NBINS; e++){
+	mm->bins[e] = ERROR;
+    }
+    mm->spare_head = 0;
+    mm->free_head = ERROR;
+    mm->rover = ERROR;
+    new_extent(mm, 1, mm->totalmem-1, ERROR, ERROR);
+}
+
+/****************************************************************/
+
+/* the size class of a length is the position of its highest set bit.
+ */
+static int
+size_class(size_t len){
+    int b = 0;
+    while(len > 1 && b < NBINS-1){
+	len >>= 1;
+	b++;
+    }
+    return b;
+}
+
+/****************************************************************/
+
+/* push extent e onto the bin of its size class.
+ */
+static void
+bin_extent(mmanager_t *mm, int e){
+    extent_t *ext = mm->extents + e;
+    ext->bin = size_class(ext->len);
+    ext->bin_prev = ERROR;
+    ext->bin_next = mm->bins[ext->bin];
+    if(ext->bin_next != ERROR){
+	mm->extents[ext->bin_next].bin_prev = e;
+    }
+    mm->bins[ext->bin] = e;
+}
+
+/****************************************************************/
+
+/* remove extent e from its size-class bin.
+ */
+static void
+unbin_extent(mmanager_t *mm, int e){
+    extent_t *ext = mm->extents + e;
+    if(ext->bin_prev == ERROR){
+	mm->bins[ext->bin] = ext->bin_next;
+    } else {
+	mm->extents[ext->bin_prev].bin_next = ext->bin_next;
+    }
+    if(ext->bin_next != ERROR){
+	mm->extents[ext->bin_next].bin_prev = ext->bin_prev;
+    }
+}
+
+/****************************************************************/
+
+/* take a spare record, fill it in and link it between prev and next.
+ * returns the index of the new extent.
+ */
+static int
+new_extent(mmanager_t *mm, size_t start, size_t len, int prev, int next){
+    int e = mm->spare_head;
+    assert(e != ERROR);
+    mm->spare_head = mm->extents[e].next;
+
+    mm->extents[e].start = start;
+    mm->extents[e].len = len;
+    mm->extents[e].prev = prev;
+    mm->extents[e].next = next;
+    if(prev == ERROR){
+	mm->free_head = e;
+    } else {
+	mm->extents[prev].next = e;
+    }
+    if(next != ERROR){
+	mm->extents[next].prev = e;
+    }
+    bin_extent(mm, e);
+    return e;
+}
+
+/****************************************************************/
+
+/* move or resize extent e in place, keeping its bin up to date.
+ */
+static void
+set_extent(mmanager_t *mm, int e, size_t start, size_t len){
+    extent_t *ext = mm->extents + e;
+    ext->start = start;
+    if(size_class(len) != ext->bin){
+	unbin_extent(mm, e);
+	ext->len = len;
+	bin_extent(mm, e);
+    } else {
+	ext->len = len;
+    }
+}
+
+/****************************************************************/
+
+/* unlink extent e from the free list and return its record to the spares.
+ */
+static void
+drop_extent(mmanager_t *mm, int e){
+    extent_t *ext = mm->extents + e;
+    unbin_extent(mm, e);
+    if(ext->prev == ERROR){
+	mm->free_head = ext->next;
+    } else {
+	mm->extents[ext->prev].next = ext->next;
+    }
+    if(ext->next != ERROR){
+	mm->extents[ext->next].prev = ext->prev;
+    }
+    if(mm->rover == e){
+	mm->rover = ext->next;
+    }
+    ext->len = 0;
+    ext->next = mm->spare_head;
+    mm->spare_head = e;
+}
+
+/****************************************************************/
+
+/* give size bytes starting at ptr back to whichever structure the current
+ * policy keeps free space in.
+ */
+static void
+release_address(mmanager_t *mm, void *ptr, size_t size){
+    mark_range(mm, (char *)ptr - mm->memory, size, 0);
+    if(mm->policy == MM_POLICY_BUDDY){
+	buddy_release(mm, ptr, size);
+    } else if(mm->policy == MM_POLICY_TAGS){
+	tags_release(mm, ptr);
+    } else if(mm->policy != MM_POLICY_BITMAP){
+	extent_release(mm, ptr, size);
+    }
+}
+
+/****************************************************************/
+
+/* give size bytes starting at ptr back to the free-extent list, merging
+ * them with the extents immediately before and after when they touch.
+ */
+static void
+extent_release(mmanager_t *mm, void *ptr, size_t size){
+    size_t start = (char *)ptr - mm->memory;
+    int prev = ERROR, next = mm->free_head;
+
+    while(next != ERROR && mm->extents[next].start < start){
+	prev = next;
+	next = mm->extents[next].next;
+    }
+
+    if(prev != ERROR && mm->extents[prev].start
+       + mm->extents[prev].len == start){
+	if(next != ERROR && start + size == mm->extents[next].start){
+	    size += mm->extents[next].len;
+	    if(mm->rover == next){
+		mm->rover = prev;
+	    }
+	    drop_extent(mm, next);
+	}
+	set_extent(mm, prev, mm->extents[prev].start,
+		   mm->extents[prev].len + size);
+    } else if(next != ERROR && start + size == mm->extents[next].start){
+	set_extent(mm, next, start, mm->extents[next].len + size);
+    } else {
+	new_extent(mm, start, size, prev, next);
+    }
+}
+
+/****************************************************************/
+
+/* start the free-extent list over with the gaps around n ranges of used
+ * bytes, sorted by offset, as its extents.
+ */
+static void
+rebuild_extents(mmanager_t *mm, extent_t *ranges, int n){
+    size_t pos, end;
+    int i, prev;
+
+    init_extents(mm);
+    drop_extent(mm, mm->free_head);
+    for(i = 0, pos = 1, prev = ERROR; i<=n; i++){
+	end = i < n ? ranges[i].start : mm->totalmem;
+	if(end > pos){
+	    prev = new_extent(mm, pos, end-pos, prev, ERROR);
+	}
+	if(i < n){
+	    pos = ranges[i].start + ranges[i].len;
+	}
+    }
+}
+
+/****************************************************************/
+
+/* take len bytes from the front of the free extent that starts at offset
+ * start, which must be at least that long.
+ */
+static void
+extent_claim(mmanager_t *mm, size_t start, size_t len){
+    int e = mm->free_head;
+    while(e != ERROR && mm->extents[e].start != start){
+	e = mm->extents[e].next;
+    }
+    assert(e != ERROR && mm->extents[e].len >= len);
+    if(mm->extents[e].len == len){
+	drop_extent(mm, e);
+    } else {
+	set_extent(mm, e, start+len, mm->extents[e].len-len);
+    }
+}
+
+/****************************************************************/
+
+/* set up mm with totalmem bytes of memory that may grow by growby
+ * bytes at a time up to maxmem, and room for maxvars variables. sizes are
+ * rounded up to whole pages, or to a power of two for the buddy system,
+ * which never grows. the whole of maxmem is reserved at once so memory
+ * stays put, but pages are only committed once they are touched. returns
+ * ERROR, having given back whatever it took, if we are out of memory.
+ */
+static int
+init_manager(mmanager_t *mm, size_t totalmem, size_t maxmem, size_t growby,
+	     int maxvars){
+    totalmem = (totalmem+PAGESIZE-1) & ~(size_t)(PAGESIZE-1);
+    growby = (growby+PAGESIZE-1) & ~(size_t)(PAGESIZE-1);
+    if(mm->policy == MM_POLICY_BUDDY){
+	for(mm->maxorder = MINORDER; mm->maxorder < MAXORDER
+	    && ((size_t)1<<mm->maxorder) < totalmem; mm->maxorder++);
+	totalmem = maxmem = (size_t)1<<mm->maxorder;
+    }
+    if(maxmem < totalmem){
+	maxmem = totalmem;
+    }
+    maxmem = (maxmem+PAGESIZE-1) & ~(size_t)(PAGESIZE-1);
+
+    mm->memory = mmap(NULL, maxmem, PROT_NONE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mm->memory == MAP_FAILED){
+	mm->memory = NULL;
+	return ERROR;
+    }
+    mm->maxmem = maxmem;
+    if(mprotect(mm->memory, totalmem, PROT_READ | PROT_WRITE) != 0){
+	free_manager(mm);
+	return ERROR;
+    }
+    mm->null = mm->memory;
+    mm->totalmem = totalmem;
+    mm->growby = growby;
+    mm->maxvars = maxvars;
+
+    mm->vars = mm_new_array(maxvars, sizeof(*mm->vars));
+    mm->var_sizes = mm_new_array(maxvars, sizeof(*mm->var_sizes));
+    mm->var_align = mm_new_array(maxvars, 1);
+    mm->extents = mm_new_array(maxvars+1, sizeof(*mm->extents));
+    mm->nwords = totalmem/64;
+    mm->occupied = mm_new_array(mm->nwords, sizeof(uint64_t));
+    mm->full = mm_new_array(mm->nwords/64, sizeof(uint64_t));
+    mm->nslotwords = (maxvars+63)/64;
+    mm->free_slots = mm_new_array(mm->nslotwords, sizeof(uint64_t));
+    mm->slot_summary = mm_new_array((mm->nslotwords+63)/64,
+				    sizeof(uint64_t));
+    for(mm->hash_bits = 1; (1<<mm->hash_bits) < 2*maxvars;
+	mm->hash_bits++);
+    mm->slot_keys = mm_new_array(1<<mm->hash_bits, sizeof(size_t));
+    mm->slot_vals = mm_new_array(1<<mm->hash_bits, sizeof(int));
+    if(mm->policy == MM_POLICY_BUDDY){
+	mm->buddy_next = mm_new_array(totalmem>>MINORDER, sizeof(int));
+	mm->buddy_prev = mm_new_array(totalmem>>MINORDER, sizeof(int));
+	mm->buddy_free = mm_new_array(totalmem>>MINORDER, 1);
+    }
+    if(!mm->vars || !mm->var_sizes || !mm->var_align || !mm->extents
+       || !mm->occupied || !mm->full || !mm->free_slots
+       || !mm->slot_summary || !mm->slot_keys || !mm->slot_vals
+       || (mm->policy == MM_POLICY_BUDDY && (!mm->buddy_next
+					     || !mm->buddy_prev
+					     || !mm->buddy_free))){
+	free_manager(mm);
+	return ERROR;
+    }
+
+    init_bitmap(mm);
+    init_vars(mm);
+    if(mm->policy == MM_POLICY_BUDDY){
+	init_buddy(mm);
+    } else if(mm->policy == MM_POLICY_TAGS){
+	init_tags(mm, TAG_START);
+    } else {
+	init_extents(mm);
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* give back everything init_manager() took for mm, even if it did not
+ * get to the end.
+ */
+static void
+free_manager(mmanager_t *mm){
+    if(mm->memory){
+	munmap(mm->memory, mm->maxmem);
+    }
+    free(mm->vars);
+    free(mm->var_sizes);
+    free(mm->var_align);
+    free(mm->extents);
+    free(mm->occupied);
+    free(mm->full);
+    free(mm->free_slots);
+    free(mm->slot_summary);
+    free(mm->slot_keys);
+    free(mm->slot_vals);
+    free(mm->buddy_next);
+    free(mm->buddy_prev);
+    free(mm->buddy_free);
+    free(mm->var_slab);
+    free(mm->slabs);
+    free(mm->dirty);
+    free(mm->dirty_vars);
+    memset(mm, 0, sizeof(*mm));
+}
+
+/****************************************************************/
+
+/* allocate a zeroed array of n elements. returns NULL if we are out of
+ * memory.
+ */
+void *
+mm_new_array(size_t n, size_t size){
+    return calloc(n ? n : 1, size);
+}
+
+/****************************************************************/
+
+/* extend an array from n to more elements, zeroing the new ones. returns
+ * NULL, leaving array as it was, if we are out of memory.
+ */
+void *
+mm_grow_array(void *array, size_t n, size_t more, size_t size){
+    array = realloc(array, more*size);
+    if(!array){
+	return NULL;
+    }
+    memset((char *)array + n*size, 0, (more-n)*size);
+    return array;
+}
+
+/****************************************************************/
+
+/* add at least size more bytes to the end of memory, growby at a time but
+ * never beyond maxmem, and hand them to the free space. returns ERROR if
+ * memory cannot grow any further or we are out of memory.
+ */
+static int
+grow_memory(mmanager_t *mm, size_t size){
+    size_t old = mm->totalmem, add = mm->growby;
+    uint64_t *occupied, *full;
+
+    if(mm->policy == MM_POLICY_BUDDY || old == mm->maxmem){
+	return ERROR;
+    }
+    while(add < size){
+	add += mm->growby;
+    }
+    if(add > mm->maxmem-old){
+	add = mm->maxmem-old;
+    }
+    if(mprotect(mm->memory+old, add, PROT_READ | PROT_WRITE) != 0){
+	return ERROR;
+    }
+
+    /* the bitmaps may end up longer than they need be, which is harmless */
+    occupied = mm_grow_array(mm->occupied, mm->nwords, (old+add)/64,
+			     sizeof(uint64_t));
+    mm->occupied = occupied ? occupied : mm->occupied;
+    full = mm_grow_array(mm->full, mm->nwords/64, (old+add)/64/64,
+			 sizeof(uint64_t));
+    mm->full = full ? full : mm->full;
+    if(!occupied || !full){
+	mprotect(mm->memory+old, add, PROT_NONE);
+	return ERROR;
+    }
+    mm->nwords = (old+add)/64;
+    mm->totalmem = old+add;
+    STAT_ADD(mm, grows, 1);
+    if(mm->policy == MM_POLICY_TAGS){
+	/* a used block of its own, so that freeing it merges it */
+	tag_set(mm, old, add, 1);
+	tags_release(mm, mm->memory + old + TAG_WORD);
+    } else if(mm->policy != MM_POLICY_BITMAP){
+	extent_release(mm, mm->memory+old, add);
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* set up the occupancy bitmap with only our very own NULL in use.
+ */
+static void
+init_bitmap(mmanager_t *mm){
+    mark_range(mm, 0, 1, 1);
+}
+
+/****************************************************************/
+
+/* set (used != 0) or clear the occupancy bits of len bytes from offset
+ * start, keeping the summary of completely used words in step.
+ */
+static void
+mark_range(mmanager_t *mm, size_t start, size_t len, int used){
+    size_t w = start>>6, last = (start+len-1)>>6;
+    uint64_t mask;
+
+    if(len == 0){
+	return;
+    }
+    for(; w<=last; w++){
+	mask = ~(uint64_t)0;
+	if(w == start>>6){
+	    mask &= ~(uint64_t)0 << (start&63);
+	}
+	if(w == last && ((start+len)&63)){
+	    mask &= ~(~(uint64_t)0 << ((start+len)&63));
+	}
+	if(used){
+	    mm->occupied[w] |= mask;
+	} else {
+	    mm->occupied[w] &= ~mask;
+	}
+	if(mm->occupied[w] == ~(uint64_t)0){
+	    mm->full[w>>6] |= (uint64_t)1 << (w&63);
+	} else {
+	    mm->full[w>>6] &= ~((uint64_t)1 << (w&63));
+	}
+    }
+}
+
+/****************************************************************/
+
+/* index of the first word in v[from..to) that differs from pattern (0 or
+ * all ones), or to if there is none. Whole vectors are compared at a time
+ * where the compiler lets us.
+ */
+static size_t
+find_word(const uint64_t *v, size_t from, size_t to, uint64_t pattern){
+#if defined(__AVX2__)
+    __m256i pat = _mm256_set1_epi64x((long long)pattern);
+    while(from+4 <= to && _mm256_movemask_epi8(_mm256_cmpeq_epi64(
+	  _mm256_loadu_si256((const __m256i *)(v+from)), pat)) == -1){
+	from += 4;
+    }
+#elif defined(__SSE2__)
+    __m128i pat = _mm_set1_epi64x((long long)pattern);
+    while(from+2 <= to && _mm_movemask_epi8(_mm_cmpeq_epi8(
+	  _mm_loadu_si128((const __m128i *)(v+from)), pat)) == 0xffff){
+	from += 2;
+    }
+#endif
+    while(from < to && v[from] == pattern){
+	from++;
+    }
+    return from;
+}
+
+/****************************************************************/
+
+/* the offset of the first free byte at or after pos, or totalmem. Runs of
+ * completely used words are stepped over through the summary bitmap.
+ */
+static size_t
+next_clear(mmanager_t *mm, size_t pos){
+    size_t w = pos>>6, s;
+    uint64_t x;
+
+    if(pos >= mm->totalmem){
+	return mm->totalmem;
+    }
+    x = ~mm->occupied[w] & (~(uint64_t)0 << (pos&63));
+    if(x){
+	return (w<<6) + __builtin_ctzll(x);
+    }
+    for(w++; w<mm->nwords; w = (s+1)<<6){
+	s = w>>6;
+	x = ~mm->full[s] & (~(uint64_t)0 << (w&63));
+	if(!x){
+	    s = find_word(mm->full, s+1, mm->nwords>>6, ~(uint64_t)0);
+	    if(s == mm->nwords>>6){
+		break;
+	    }
+	    x = ~mm->full[s];
+	}
+	w = (s<<6) + __builtin_ctzll(x);
+	return (w<<6) + __builtin_ctzll(~mm->occupied[w]);
+    }
+    return mm->totalmem;
+}
+
+/****************************************************************/
+
+/* the offset of the first used byte in [pos, end), or end if none is.
+ */
+static size_t
+next_set(mmanager_t *mm, size_t pos, size_t end){
+    size_t w = pos>>6, last;
+    uint64_t x;
+
+    if(pos >= end){
+	return end;
+    }
+    last = (end-1)>>6;
+    x = mm->occupied[w] & (~(uint64_t)0 << (pos&63));
+    if(!x && w < last){
+	w = find_word(mm->occupied, w+1, last, 0);
+	x = mm->occupied[w];
+    }
+    if(x){
+	pos = (w<<6) + __builtin_ctzll(x);
+	return pos < end ? pos : end;
+    }
+    return end;
+}
+
+/****************************************************************/
+
+/* find the lowest offset, a multiple of align, of a run of size free
+ * bytes, starting the search at from. returns totalmem if there is no
+ * such run.
+ */
+static size_t
+find_free_run(mmanager_t *mm, size_t size, size_t from, size_t align){
+    size_t end, first = from, run;
+    while((run = next_clear(mm, from)) + size <= mm->totalmem){
+	from = ALIGN_UP(run, align);
+	if(from + size > mm->totalmem){
+	    break;
+	}
+	end = next_set(mm, from, from+size);
+	STAT_ADD(mm, runs, 1);
+	if(end == from+size){
+	    STAT_ADD(mm, scanned, end - first);
+	    STAT_ADD(mm, align_padding, from - run);
+	    return from;
+	}
+	STAT_ADD(mm, runs_failed, 1);
+	from = end;
+    }
+    STAT_ADD(mm, scanned, mm->totalmem - first);
+    return mm->totalmem;
+}
+
+/****************************************************************/
+
+/* the buddy order of a request is the smallest order whose block holds it.
+ */
+static int
+buddy_order(size_t size){
+    int order = MINORDER;
+    while(((size_t)1<<order) < size){
+	order++;
+    }
+    return order;
+}
+
+/****************************************************************/
+
+/* set up the buddy free lists with the whole of mm->memory as one
+ * block, then take the lowest minimum-sized block for our own NULL.
+ */
+static void
+init_buddy(mmanager_t *mm){
+    int order;
+    for(order = 0; order<=MAXORDER; order++){
+	mm->buddy_heads[order] = ERROR;
+    }
+    memset(mm->buddy_free, ERROR, mm->totalmem>>MINORDER);
+    buddy_push(mm, 0, mm->maxorder);
+    buddy_alloc(mm, 1);
+    mm->buddy_requested = mm->buddy_reserved = 0;
+}
+
+/****************************************************************/
+
+/* put the free block at unit u (offset >> MINORDER) on the list of order.
+ */
+static void
+buddy_push(mmanager_t *mm, int u, int order){
+    mm->buddy_free[u] = order;
+    mm->buddy_prev[u] = ERROR;
+    mm->buddy_next[u] = mm->buddy_heads[order];
+    if(mm->buddy_next[u] != ERROR){
+	mm->buddy_prev[mm->buddy_next[u]] = u;
+    }
+    mm->buddy_heads[order] = u;
+}
+
+/****************************************************************/
+
+/* take the free block at unit u off its free list.
+ */
+static void
+buddy_unlink(mmanager_t *mm, int u){
+    int order = mm->buddy_free[u];
+    if(mm->buddy_prev[u] == ERROR){
+	mm->buddy_heads[order] = mm->buddy_next[u];
+    } else {
+	mm->buddy_next[mm->buddy_prev[u]] = mm->buddy_next[u];
+    }
+    if(mm->buddy_next[u] != ERROR){
+	mm->buddy_prev[mm->buddy_next[u]] = mm->buddy_prev[u];
+    }
+    mm->buddy_free[u] = ERROR;
+}
+
+/****************************************************************/
+
+/* take a block from the smallest non-empty order that fits, splitting it
+ * in halves down to the order of the request. returns mm->null if no
+ * block is large enough.
+ */
+static void *
+buddy_alloc(mmanager_t *mm, size_t size){
+    int want, order, u;
+    if(size > mm->totalmem){
+	return mm->null;
+    }
+    want = buddy_order(size);
+    for(order = want; order<=mm->maxorder; order++){
+	STAT_ADD(mm, probes, 1);
+	if(mm->buddy_heads[order] != ERROR){
+	    break;
+	}
+    }
+    if(order > mm->maxorder){
+	return mm->null;
+    }
+    u = mm->buddy_heads[order];
+    buddy_unlink(mm, u);
+    while(order > want){
+	order--;
+	buddy_push(mm, u + (1<<(order-MINORDER)), order);
+    }
+    mm->buddy_requested += size;
+    mm->buddy_reserved += (size_t)1<<want;
+    return mm->memory + ((size_t)u<<MINORDER);
+}
+
+/****************************************************************/
+
+/* return the block of a size-byte request at ptr, merging it with its
+ * buddy for as long as the buddy is a whole free block of the same order.
+ */
+static void
+buddy_release(mmanager_t *mm, void *ptr, size_t size){
+    int order = buddy_order(size);
+    int u = ((char *)ptr - mm->memory)>>MINORDER, buddy;
+
+    mm->buddy_requested -= size;
+    mm->buddy_reserved -= (size_t)1<<order;
+    while(order < mm->maxorder){
+	buddy = u ^ (1<<(order-MINORDER));
+	if(mm->buddy_free[buddy] != order){
+	    break;
+	}
+	buddy_unlink(mm, buddy);
+	u &= buddy;
+	order++;
+    }
+    buddy_push(mm, u, order);
+}
+
+/****************************************************************/
+
+/* shrink the block of an old-byte request at offset off to the order of
+ * size bytes, handing the upper halves it no longer needs back to the
+ * free lists. their buddies are still in use, so none of them merge.
+ */
+static void
+buddy_trim(mmanager_t *mm, size_t off, size_t old, size_t size){
+    int order = buddy_order(old), want = buddy_order(size);
+    int u = off>>MINORDER;
+
+    mm->buddy_requested += size - old;
+    mm->buddy_reserved -= ((size_t)1<<order) - ((size_t)1<<want);
+    while(order > want){
+	order--;
+	buddy_push(mm, u + (1<<(order-MINORDER)), order);
+    }
+}
+
+/****************************************************************/
+
+/* report how much of the reserved buddy blocks is lost to rounding up.
+ */
+static void
+buddy_report(mmanager_t *mm, FILE *fp){
+    size_t waste = mm->buddy_reserved - mm->buddy_requested;
+    fprintf(fp, "Buddy: %lu bytes requested, %lu bytes reserved, "
+	    "%lu bytes (%.1f%%) internal fragmentation\n",
+	    (unsigned long)mm->buddy_requested,
+	    (unsigned long)mm->buddy_reserved, (unsigned long)waste,
+	    mm->buddy_reserved ? 100.0*waste/mm->buddy_reserved : 0.0);
+}
+
+/****************************************************************/
+
+/* bytes a block of a size-byte request takes up under boundary tags: the
+ * request rounded up to a whole word, a header and a footer, and never
+ * less than it takes to link the block onto the free list once freed.
+ */
+static size_t
+tag_size(size_t size){
+    size = ((size+TAG_WORD-1) & ~(size_t)(TAG_WORD-1)) + 2*TAG_WORD;
+    return size < TAG_MINBLOCK ? TAG_MINBLOCK : size;
+}
+
+/****************************************************************/
+
+/* the tag word at offset off: a block size with TAG_USED set if in use.
+ */
+static size_t
+tag_get(mmanager_t *mm, size_t off){
+    return *(size_t *)(mm->memory + off);
+}
+
+/****************************************************************/
+
+/* write the header and footer of the size-byte block at offset off.
+ */
+static void
+tag_set(mmanager_t *mm, size_t off, size_t size, int used){
+    size_t tag = size | (used ? TAG_USED : 0);
+    *(size_t *)(mm->memory + off) = tag;
+    *(size_t *)(mm->memory + off + size - TAG_WORD) = tag;
+    dirty_range(mm, off, TAG_WORD);
+    dirty_range(mm, off + size - TAG_WORD, TAG_WORD);
+}
+
+/****************************************************************/
+
+/* the free-list links of the free block at offset off live in its first
+ * two words after the header; 0 ends the list.
+ */
+static size_t *
+tag_links(mmanager_t *mm, size_t off){
+    return (size_t *)(mm->memory + off + TAG_WORD);
+}
+
+/****************************************************************/
+
+/* mark the size-byte block at offset off free and put it at the head of
+ * the free list.
+ */
+static void
+tag_push(mmanager_t *mm, size_t off, size_t size){
+    size_t *links = tag_links(mm, off);
+    tag_set(mm, off, size, 0);
+    links[0] = mm->tag_head;
+    links[1] = 0;
+    dirty_range(mm, off + TAG_WORD, 2*TAG_WORD);
+    if(mm->tag_head){
+	tag_links(mm, mm->tag_head)[1] = off;
+	dirty_range(mm, mm->tag_head + 2*TAG_WORD, TAG_WORD);
+    }
+    mm->tag_head = off;
+}
+
+/****************************************************************/
+
+/* take the free block at offset off off the free list.
+ */
+static void
+tag_unlink(mmanager_t *mm, size_t off){
+    size_t *links = tag_links(mm, off);
+    if(links[1]){
+	tag_links(mm, links[1])[0] = links[0];
+	dirty_range(mm, links[1] + TAG_WORD, TAG_WORD);
+    } else {
+	mm->tag_head = links[0];
+    }
+    if(links[0]){
+	tag_links(mm, links[0])[1] = links[1];
+	dirty_range(mm, links[0] + 2*TAG_WORD, TAG_WORD);
+    }
+}
+
+/****************************************************************/
+
+/* set up boundary tags with everything from offset start to the end of
+ * memory as one free block. the words before TAG_START, our NULL among
+ * them, are never part of a block.
+ */
+static void
+init_tags(mmanager_t *mm, size_t start){
+    mm->tag_head = 0;
+    if(start < mm->totalmem){
+	tag_push(mm, start, mm->totalmem - start);
+    }
+}
+
+/****************************************************************/
+
+/* first-fit over the free list: take the first free block big enough for
+ * size bytes, splitting off what is left when that can stand as a block
+ * of its own. returns the address after its header, a multiple of align,
+ * or mm->null. contents are always aligned to a word; for more, the
+ * block is split where the header of an aligned block goes, as long as
+ * what is left in front can stand as a free block too.
+ */
+static void *
+tags_alloc(mmanager_t *mm, size_t size, size_t align){
+    size_t need = tag_size(size), off, have, pad;
+
+    for(off = mm->tag_head; off; off = tag_links(mm, off)[0]){
+	STAT_ADD(mm, probes, 1);
+	have = tag_get(mm, off);
+	pad = ALIGN_UP(off + TAG_WORD, align) - TAG_WORD - off;
+	while(pad > 0 && pad < TAG_MINBLOCK){
+	    pad += align;
+	}
+	if(have >= pad + need){
+	    tag_unlink(mm, off);
+	    if(pad > 0){
+		STAT_ADD(mm, align_padding, pad);
+		tag_push(mm, off, pad);
+		off += pad;
+		have -= pad;
+	    }
+	    if(have - need >= TAG_MINBLOCK){
+		tag_push(mm, off + need, have - need);
+		have = need;
+	    }
+	    tag_set(mm, off, have, 1);
+	    return mm->memory + off + TAG_WORD;
+	}
+    }
+    return mm->null;
+}
+
+/****************************************************************/
+
+/* free the block whose contents start at ptr, merging it with the blocks
+ * just before and after it when they are free. the footer of the one and
+ * the header of the other say so straight away, so no list is searched.
+ */
+static void
+tags_release(mmanager_t *mm, void *ptr){
+    size_t off = (char *)ptr - mm->memory - TAG_WORD;
+    size_t size = tag_get(mm, off) & ~(size_t)TAG_USED, tag;
+
+    if(off > TAG_START && !((tag = tag_get(mm, off - TAG_WORD)) & TAG_USED)){
+	off -= tag;
+	size += tag;
+	tag_unlink(mm, off);
+    }
+    if(off + size < mm->totalmem
+       && !((tag = tag_get(mm, off + size)) & TAG_USED)){
+	tag_unlink(mm, off + size);
+	size += tag;
+    }
+    tag_push(mm, off, size);
+}
+
+/****************************************************************/
+
+/* resize the block whose contents start at ptr to hold size bytes without
+ * moving it: a shrinking block gives back its tail when that can stand as
+ * a block of its own, and a growing one takes in the free block after it.
+ * returns ERROR, with nothing changed, if it has to move.
+ */
+static int
+tags_resize(mmanager_t *mm, void *ptr, size_t size){
+    size_t off = (char *)ptr - mm->memory - TAG_WORD, need = tag_size(size);
+    size_t have = tag_get(mm, off) & ~(size_t)TAG_USED, tag;
+
+    if(need > have){
+	if(off + have == mm->totalmem
+	   || (tag = tag_get(mm, off + have)) & TAG_USED
+	   || have + tag < need){
+	    return ERROR;
+	}
+	tag_unlink(mm, off + have);
+	have += tag;
+    }
+    if(have - need >= TAG_MINBLOCK){
+	tag_set(mm, off, need, 1);
+	tag_set(mm, off + need, have - need, 1);
+	tags_release(mm, mm->memory + off + need + TAG_WORD);
+    } else {
+	tag_set(mm, off, have, 1);
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* walk every block from TAG_START to the end of memory, checking that the
+ * tags agree and that no two free blocks touch, and report what the tags
+ * and rounding cost the live variables.
+ */
+static void
+tags_report(mmanager_t *mm, FILE *fp){
+    size_t off, size, tag, requested = 0, reserved = 0, overhead;
+    size_t used = 0, unused = 0, bad = 0;
+    int prev_free = 0, i;
+
+    for(off = TAG_START; off + TAG_MINBLOCK <= mm->totalmem; off += size){
+	tag = tag_get(mm, off);
+	size = tag & ~(size_t)TAG_USED;
+	if(size < TAG_MINBLOCK || size > mm->totalmem - off
+	   || tag_get(mm, off + size - TAG_WORD) != tag){
+	    bad = off;
+	    break;
+	}
+	if(tag & TAG_USED){
+	    /* a slab is one block, whatever its objects are */
+	    if(slab_at(mm, off + TAG_WORD) != ERROR){
+		requested += SLAB_SIZE;
+	    } else if((i = slot_find(mm, off + TAG_WORD)) == ERROR){
+		bad = bad ? bad : off;
+	    } else {
+		requested += mm->var_sizes[i];
+	    }
+	    reserved += size;
+	    used++;
+	    prev_free = 0;
+	} else {
+	    bad = bad || !prev_free ? bad : off;
+	    unused++;
+	    prev_free = 1;
+	}
+    }
+    overhead = reserved - requested;
+    fprintf(fp, "Tags: %lu blocks in use, %lu free, %lu bytes requested, "
+	    "%lu bytes reserved, %lu bytes (%.1f per block) of tags and "
+	    "padding\n", (unsigned long)used, (unsigned long)unused,
+	    (unsigned long)requested, (unsigned long)reserved,
+	    (unsigned long)overhead, used ? (double)overhead/used : 0.0);
+    if(bad){
+	fprintf(fp, "Tags: heap is corrupt at offset %lu\n",
+		(unsigned long)bad);
+    }
+}
+
+/****************************************************************/
+
+/* bring the tags of a freshly set up mm in line with n variables at
+ * offsets with sizes, sorted as ranges (see restore_manager()), with the
+ * gaps around them as free blocks. a block that shrank in place may have
+ * kept a tail too small to be a block of its own, so such a gap goes back
+ * to the block before it. returns ERROR, with nothing changed, if the
+ * first block leaves too small a gap in front of it.
+ */
+static int
+tags_restore(mmanager_t *mm, extent_t *ranges, int n){
+    size_t pos, end;
+    int i;
+
+    if(n > 0 && ranges[0].start > TAG_START
+       && ranges[0].start - TAG_START < TAG_MINBLOCK){
+	return ERROR;
+    }
+    mm->tag_head = 0;
+    for(i = 0, pos = TAG_START; i<=n; i++){
+	end = i < n ? ranges[i].start : mm->totalmem;
+	if(end > pos && end - pos < TAG_MINBLOCK){
+	    ranges[i-1].len += end - pos;
+	    tag_set(mm, ranges[i-1].start, ranges[i-1].len, 1);
+	} else if(end > pos){
+	    tag_push(mm, pos, end - pos);
+	}
+	if(i < n){
+	    tag_set(mm, end, ranges[i].len, 1);
+	    pos = end + ranges[i].len;
+	}
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* set up the slab layer with no slabs: every record is spare and no
+ * variable lives in a slab.
+ */
+static void
+init_slabs(mmanager_t *mm){
+    int c, s;
+    for(c = 0; c<SLAB_CLASSES; c++){
+	mm->slab_heads[c] = ERROR;
+    }
+    mm->slab_spare = ERROR;
+    for(s = mm->nslabs-1; s>=0; s--){
+	mm->slabs[s].used = 0;
+	mm->slabs[s].next = mm->slab_spare;
+	mm->slab_spare = s;
+    }
+    for(s = 0; s<mm->maxvars; s++){
+	mm->var_slab[s] = ERROR;
+    }
+}
+
+/****************************************************************/
+
+/* the smallest size class that holds size bytes, at most SLAB_MAXSIZE.
+ */
+static int
+slab_class(size_t size){
+    int c = 0;
+    while(((size_t)1<<(SLAB_MINSHIFT+c)) < size){
+	c++;
+    }
+    return c;
+}
+
+/****************************************************************/
+
+/* put slab s at the head of the slabs of its class with a free object.
+ */
+static void
+slab_push(mmanager_t *mm, int s){
+    slab_t *slab = mm->slabs + s;
+    slab->prev = ERROR;
+    slab->next = mm->slab_heads[slab->class];
+    if(slab->next != ERROR){
+	mm->slabs[slab->next].prev = s;
+    }
+    mm->slab_heads[slab->class] = s;
+}
+
+/****************************************************************/
+
+/* take slab s off the slabs of its class with a free object.
+ */
+static void
+slab_unlink(mmanager_t *mm, int s){
+    slab_t *slab = mm->slabs + s;
+    if(slab->prev == ERROR){
+	mm->slab_heads[slab->class] = slab->next;
+    } else {
+	mm->slabs[slab->prev].next = slab->next;
+    }
+    if(slab->next != ERROR){
+	mm->slabs[slab->next].prev = slab->prev;
+    }
+}
+
+/****************************************************************/
+
+/* carve a new slab of class c out of memory, with every object free,
+ * and return its record, or ERROR if there is no room for it.
+ */
+static int
+new_slab(mmanager_t *mm, int c){
+    char *start;
+
+    if(slab_spares(mm, 1) == ERROR){
+	return ERROR;
+    }
+    start = select_address(mm, SLAB_SIZE, SLAB_ALIGN);
+    if(start == mm->null){
+	return ERROR;
+    }
+    return slab_record(mm, start - mm->memory, c);
+}
+
+/****************************************************************/
+
+/* make sure mm has at least n spare slab records. returns ERROR if we are
+ * out of memory for them.
+ */
+static int
+slab_spares(mmanager_t *mm, int n){
+    int s, more, spare = 0;
+    slab_t *slabs;
+
+    for(s = mm->slab_spare; s != ERROR && spare < n; s = mm->slabs[s].next){
+	spare++;
+    }
+    if(spare == n){
+	return SUCCESS;
+    }
+    for(more = mm->nslabs ? 2*mm->nslabs : 8; more-mm->nslabs < n-spare;
+	more *= 2);
+    slabs = mm_grow_array(mm->slabs, mm->nslabs, more, sizeof(*slabs));
+    if(!slabs){
+	return ERROR;
+    }
+    mm->slabs = slabs;
+    for(s = more-1; s>=mm->nslabs; s--){
+	mm->slabs[s].next = mm->slab_spare;
+	mm->slab_spare = s;
+    }
+    mm->nslabs = more;
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* give the slab of class c at offset off, whose bytes are already taken
+ * from the free space, a record with every object free, and return it.
+ * there must be a spare record for it, see slab_spares().
+ */
+static int
+slab_record(mmanager_t *mm, size_t off, int c){
+    int s, n = SLAB_SIZE >> (SLAB_MINSHIFT+c), w;
+    slab_t *slab;
+
+    assert(mm->slab_spare != ERROR);
+    s = mm->slab_spare;
+    slab = mm->slabs + s;
+    mm->slab_spare = slab->next;
+
+    slab->offset = off;
+    slab->class = c;
+    slab->used = 0;
+    for(w = 0; w<SLAB_WORDS; w++, n -= 64){
+	slab->free[w] = n >= 64 ? ~(uint64_t)0
+	    : n > 0 ? ~(~(uint64_t)0 << n) : 0;
+    }
+    slab_push(mm, s);
+    return s;
+}
+
+/****************************************************************/
+
+/* hand out a free object of the size class of size bytes for variable
+ * idx, from the first slab of the class with one free, or from a new slab
+ * if there is none. the slab is dropped from its class once full.
+ * returns mm->null if a new slab does not fit.
+ */
+static void *
+slab_alloc(mmanager_t *mm, size_t size, int idx){
+    int c = slab_class(size), s = mm->slab_heads[c], w, bit;
+    slab_t *slab;
+
+    if(s == ERROR && (s = new_slab(mm, c)) == ERROR){
+	return mm->null;
+    }
+    slab = mm->slabs + s;
+    for(w = 0; slab->free[w] == 0; w++);
+    bit = __builtin_ctzll(slab->free[w]);
+    slab->free[w] &= slab->free[w] - 1;
+    if(++slab->used == SLAB_SIZE >> (SLAB_MINSHIFT+c)){
+	slab_unlink(mm, s);
+    }
+    mm->var_slab[idx] = s;
+    return mm->memory + slab->offset
+	+ ((size_t)(w*64 + bit) << (SLAB_MINSHIFT+c));
+}
+
+/****************************************************************/
+
+/* hand the free object at offset off of slab s to variable idx, as
+ * slab_alloc() would have.
+ */
+static void
+slab_claim(mmanager_t *mm, int s, size_t off, int idx){
+    slab_t *slab = mm->slabs + s;
+    size_t n = (off - slab->offset) >> (SLAB_MINSHIFT+slab->class);
+
+    slab->free[n>>6] &= ~((uint64_t)1 << (n&63));
+    if(++slab->used == SLAB_SIZE >> (SLAB_MINSHIFT+slab->class)){
+	slab_unlink(mm, s);
+    }
+    mm->var_slab[idx] = s;
+}
+
+/****************************************************************/
+
+/* give the object at ptr back to slab s. a slab that was full can hand
+ * out objects again, and one left empty goes back to the free space as a
+ * whole.
+ */
+static void
+slab_release(mmanager_t *mm, int s, void *ptr){
+    slab_t *slab = mm->slabs + s;
+    size_t n = ((char *)ptr - mm->memory - slab->offset)
+	>> (SLAB_MINSHIFT+slab->class);
+
+    if(slab->used-- == SLAB_SIZE >> (SLAB_MINSHIFT+slab->class)){
+	slab_push(mm, s);
+    }
+    slab->free[n>>6] |= (uint64_t)1 << (n&63);
+    if(slab->used == 0){
+	slab_unlink(mm, s);
+	release_address(mm, mm->memory + slab->offset, SLAB_SIZE);
+	slab->next = mm->slab_spare;
+	mm->slab_spare = s;
+    }
+}
+
+/****************************************************************/
+
+/* the slab that starts at offset off, or ERROR if none does. only
+ * reports need it, so every slab is looked at.
+ */
+static int
+slab_at(mmanager_t *mm, size_t off){
+    int s;
+    for(s = 0; mm->var_slab && s<mm->nslabs; s++){
+	if(mm->slabs[s].used > 0 && mm->slabs[s].offset == off){
+	    return s;
+	}
+    }
+    return ERROR;
+}
+
+/****************************************************************/
+
+/* report how full the slabs of each size class are.
+ */
+static void
+slab_report(mmanager_t *mm, FILE *fp){
+    size_t objects[SLAB_CLASSES] = {0}, used[SLAB_CLASSES] = {0};
+    int slabs[SLAB_CLASSES] = {0}, s, c;
+
+    for(s = 0; s<mm->nslabs; s++){
+	if(mm->slabs[s].used > 0){
+	    c = mm->slabs[s].class;
+	    slabs[c]++;
+	    objects[c] += SLAB_SIZE >> (SLAB_MINSHIFT+c);
+	    used[c] += mm->slabs[s].used;
+	}
+    }
+    for(c = 0; c<SLAB_CLASSES; c++){
+	fprintf(fp, "Slabs: %d byte objects, %d slabs, %lu of %lu objects "
+		"in use\n", 1<<(SLAB_MINSHIFT+c), slabs[c],
+		(unsigned long)used[c], (unsigned long)objects[c]);
+    }
+}
+
+/****************************************************************/
+
+/* the thread-safe front end. each arena is a manager of its own behind a
+ * lock; a thread sticks to one arena, keeps recently freed small blocks in
+ * a cache nobody else touches, and hands blocks that belong to another
+ * arena back through that arena's lock-free remote-free list. returns
+ * ERROR, having set up nothing, if there are too many or too few arenas
+ * or we are out of memory for them.
+ */
+int
+mt_init(int narenas, size_t arena_size, int maxvars, int policy){
+    int a;
+    if(narenas < 1 || narenas > MT_MAXARENAS || posix_memalign(
+       (void **)&mt_arenas, 64, narenas*sizeof(*mt_arenas)) != 0){
+	return ERROR;
+    }
+    memset(mt_arenas, 0, narenas*sizeof(*mt_arenas));
+    for(a = 0; a<narenas; a++){
+	pthread_mutex_init(&mt_arenas[a].lock, NULL);
+	mt_arenas[a].mm.policy = policy;
+	if(init_manager(&mt_arenas[a].mm, arena_size, 0, arena_size,
+			maxvars) == ERROR){
+	    pthread_mutex_destroy(&mt_arenas[a].lock);
+	    mt_narenas = a;
+	    mt_destroy();
+	    return ERROR;
+	}
+    }
+    mt_narenas = narenas;
+    __atomic_store_n(&mt_next_arena, 0, __ATOMIC_SEQ_CST);
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* tear down every arena. all threads must have stopped using them.
+ */
+void
+mt_destroy(void){
+    int a;
+    for(a = 0; a<mt_narenas; a++){
+	pthread_mutex_destroy(&mt_arenas[a].lock);
+	free_manager(&mt_arenas[a].mm);
+    }
+    free(mt_arenas);
+    mt_arenas = NULL;
+    mt_narenas = 0;
+}
+
+/****************************************************************/
+
+/* the size class of a request, or MT_CLASSES if it is too big to cache.
+ */
+static int
+mt_class(size_t size){
+    int class = 0;
+    while(class < MT_CLASSES && ((size_t)MT_MINSIZE<<class) < size){
+	class++;
+    }
+    return class;
+}
+
+/****************************************************************/
+
+/* free every block other threads have handed back to arena. the caller
+ * holds its lock.
+ */
+static void
+mt_drain(mt_arena_t *arena){
+    mt_node_t *node = __atomic_exchange_n(&arena->remote, NULL,
+					   __ATOMIC_SEQ_CST), *next;
+    for(; node; node = next){
+	next = node->next;
+	manager_free(&arena->mm, (char *)node - MT_HEADER);
+    }
+}
+
+/****************************************************************/
+
+/* allocate size bytes from this thread's arena, trying the others in turn
+ * when it is full. returns NULL if no arena has room.
+ */
+void *
+mt_malloc(size_t size){
+    mt_cache_t *cache = &mt_cache;
+    int class = mt_class(size), a, tries;
+    size_t bytes = MT_HEADER
+	+ (class < MT_CLASSES ? (size_t)MT_MINSIZE<<class : size);
+    mt_node_t *node;
+    mt_header_t *header;
+    mt_arena_t *arena;
+
+    if(cache->arena == ERROR){
+	cache->arena = __atomic_fetch_add(&mt_next_arena, 1,
+					     __ATOMIC_SEQ_CST) % mt_narenas;
+    }
+    if(class < MT_CLASSES && (node = cache->bins[class]) != NULL){
+	cache->bins[class] = node->next;
+	cache->count[class]--;
+	return node;
+    }
+
+    for(tries = 0, a = cache->arena; tries<mt_narenas;
+	tries++, a = (a+1) % mt_narenas){
+	arena = mt_arenas + a;
+	pthread_mutex_lock(&arena->lock);
+	mt_drain(arena);
+	/* aligned like malloc(), for any type, once past the header */
+	header = manager_malloc(&arena->mm, bytes, MT_HEADER);
+	pthread_mutex_unlock(&arena->lock);
+	if((void *)header != arena->mm.null){
+	    header->arena = a;
+	    header->class = class;
+	    return (char *)header + MT_HEADER;
+	}
+    }
+    return NULL;
+}
+
+/****************************************************************/
+
+/* free a block from mt_malloc(). small blocks of this thread's arena go
+ * into its cache, blocks of other arenas onto their remote-free lists.
+ */
+void
+mt_free(void *ptr){
+    mt_cache_t *cache = &mt_cache;
+    mt_header_t *header = (mt_header_t *)((char *)ptr - MT_HEADER);
+    mt_arena_t *arena = mt_arenas + header->arena;
+    mt_node_t *node = ptr, *head;
+    int class = header->class;
+
+    if(header->arena != cache->arena){
+	head = __atomic_load_n(&arena->remote, __ATOMIC_SEQ_CST);
+	do {
+	    node->next = head;
+	} while(!__atomic_compare_exchange_n(&arena->remote, &head, node, 1,
+					     __ATOMIC_SEQ_CST,
+					     __ATOMIC_SEQ_CST));
+	return;
+    }
+    if(class < MT_CLASSES && cache->count[class] < MT_CACHED){
+	node->next = cache->bins[class];
+	cache->bins[class] = node;
+	cache->count[class]++;
+	return;
+    }
+    pthread_mutex_lock(&arena->lock);
+    mt_drain(arena);
+    manager_free(&arena->mm, header);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/****************************************************************/
+
+/* give the blocks in this thread's cache back to its arena, as a thread
+ * should before it exits.
+ */
+void
+mt_flush(void){
+    mt_cache_t *cache = &mt_cache;
+    mt_arena_t *arena;
+    mt_node_t *node;
+    int class;
+
+    if(cache->arena == ERROR){
+	return;
+    }
+    arena = mt_arenas + cache->arena;
+    pthread_mutex_lock(&arena->lock);
+    for(class = 0; class<MT_CLASSES; class++){
+	while((node = cache->bins[class]) != NULL){
+	    cache->bins[class] = node->next;
+	    manager_free(&arena->mm, (char *)node - MT_HEADER);
+	}
+	cache->count[class] = 0;
+    }
+    mt_drain(arena);
+    pthread_mutex_unlock(&arena->lock);
+    cache->arena = ERROR;
+}
+
+/****************************************************************/
+
+/* add up the free space of mm, the largest free block and the number of
+ * free blocks (holes). the buddy system and boundary tags can only hand
+ * out whole free blocks, so their free lists are counted rather than the
+ * bitmap.
+ */
+static void
+free_stats(mmanager_t *mm, size_t *total, size_t *largest, size_t *holes){
+    size_t pos, end;
+    int order, u;
+
+    *total = *largest = *holes = 0;
+    if(mm->policy == MM_POLICY_BUDDY){
+	for(order = MINORDER; order<=mm->maxorder; order++){
+	    for(u = mm->buddy_heads[order]; u != ERROR;
+		u = mm->buddy_next[u]){
+		*total += (size_t)1<<order;
+		*largest = (size_t)1<<order;
+		(*holes)++;
+	    }
+	}
+	return;
+    }
+    if(mm->policy == MM_POLICY_TAGS){
+	for(pos = mm->tag_head; pos; pos = tag_links(mm, pos)[0]){
+	    end = tag_get(mm, pos);
+	    *total += end;
+	    if(end > *largest){
+		*largest = end;
+	    }
+	    (*holes)++;
+	}
+	return;
+    }
+    for(pos = next_clear(mm, 0); pos < mm->totalmem;
+	pos = next_clear(mm, end)){
+	end = next_set(mm, pos, mm->totalmem);
+	*total += end-pos;
+	if(end-pos > *largest){
+	    *largest = end-pos;
+	}
+	(*holes)++;
+    }
+}
+
+/****************************************************************/
+
+/* order extents by where they start, for qsort().
+ */
+static int
+compare_extents(const void *a, const void *b){
+    const extent_t *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/****************************************************************/
+
+/* order offsets, for qsort() and bsearch().
+ */
+static int
+compare_offsets(const void *a, const void *b){
+    const size_t *x = a, *y = b;
+    return *x < *y ? -1 : *x > *y;
+}
+
+/****************************************************************/
+
+/* whether any two of the n ranges overlap. they are sorted by where
+ * they start on the way.
+ */
+static int
+overlapping(extent_t *ranges, int n){
+    int i;
+    qsort(ranges, n, sizeof(*ranges), compare_extents);
+    for(i = 1; i<n; i++){
+	if(ranges[i].start < ranges[i-1].start + ranges[i-1].len){
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/****************************************************************/
+
+/* take the block of a size-byte request at offset off out of the buddy
+ * free lists, splitting the free block that contains it as often as
+ * needed. the block must be free and aligned to its own size.
+ */
+static void
+buddy_claim(mmanager_t *mm, size_t off, size_t size){
+    int want = buddy_order(size), order, u = off>>MINORDER, b = u, half;
+
+    for(order = want; order<=mm->maxorder; order++){
+	b = u & ~((1<<(order-MINORDER)) - 1);
+	if(mm->buddy_free[b] == order){
+	    break;
+	}
+    }
+    assert(order <= mm->maxorder);
+    buddy_unlink(mm, b);
+    while(order > want){
+	order--;
+	half = 1<<(order-MINORDER);
+	if(u & half){
+	    buddy_push(mm, b, order);
+	    b += half;
+	} else {
+	    buddy_push(mm, b + half, order);
+	}
+    }
+    mm->buddy_requested += size;
+    mm->buddy_reserved += (size_t)1<<want;
+}
+
+/****************************************************************/
+
+/* the block that a variable of size bytes at offset off, allocated with
+ * alignment align, takes up in a freshly set up mm, into *range. returns
+ * ERROR if no allocation could have left it there.
+ */
+static int
+restore_block(mmanager_t *mm, extent_t *range, size_t off, size_t size,
+	      size_t align){
+    range->start = off;
+    range->len = size;
+    if(mm->policy == MM_POLICY_BUDDY){
+	/* as in buddy_alloc(), the block covers the alignment too */
+	range->len = (size_t)1<<buddy_order(size < align ? align : size);
+    } else if(mm->policy == MM_POLICY_TAGS){
+	/* the block starts at the header in front of the variable */
+	if(off < TAG_START + TAG_WORD || off % TAG_WORD){
+	    return ERROR;
+	}
+	range->start -= TAG_WORD;
+	range->len = tag_size(size);
+    }
+    if(off == 0 || size == 0 || off > mm->totalmem || off & (align-1)
+       || range->len > mm->totalmem-range->start
+       || (off & (range->len-1) && mm->policy == MM_POLICY_BUDDY)){
+	return ERROR;
+    }
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* bring a freshly set up mm, whose memory already holds the bytes of the
+ * variables, to the state where n variables live at offsets[i] with
+ * sizes[i], allocated with alignment aligns[i] (1 if aligns is NULL), as
+ * mm_malloc_aligned() would have. a variable whose slabs[i] is not 0 is
+ * one of the objects of objects[i] bytes of the slab that starts there,
+ * which is put back as a block of its own; mm must be using slabs then.
+ * the variables take indexes 0 to n-1 in that order and everything
+ * around them becomes free space. nothing is changed, and ERROR is
+ * returned, if the variables do not fit, overlap, are not aligned, are
+ * not objects their slab could have handed out, or (for the buddy
+ * system) do not sit on blocks of their own size, or (for boundary tags)
+ * leave no room for tags or gaps too small to be free blocks, or if we
+ * are out of memory.
+ */
+static int
+restore_manager(mmanager_t *mm, size_t *offsets, size_t *sizes,
+		size_t *aligns, size_t *slabs, size_t *objects, int n){
+    extent_t *ranges, *taken;
+    size_t *starts, align, *at;
+    int *slab_of, *classes, i, j, c, m = 0, ns = 0, nt = 0, bad = 0;
+
+    if(n > mm->maxvars){
+	return ERROR;
+    }
+    ranges = mm_new_array(2*n, sizeof(*ranges));
+    taken = mm_new_array(n, sizeof(*taken));
+    starts = mm_new_array(n, sizeof(*starts));
+    slab_of = mm_new_array(n, sizeof(*slab_of));
+    classes = mm_new_array(n, sizeof(*classes));
+    bad = !ranges || !taken || !starts || !slab_of || !classes;
+
+    /* a variable of its own is a block, and so is each slab */
+    for(i = 0; !bad && i<n; i++){
+	align = aligns ? aligns[i] : 1;
+	slab_of[i] = ERROR;
+	if(align == 0 || align & (align-1)){
+	    bad = 1;
+	} else if(slabs && slabs[i]){
+	    bad |= !mm->var_slab || sizes[i] == 0 || align > SLAB_ALIGN
+		|| objects[i] < (size_t)1<<SLAB_MINSHIFT
+		|| objects[i] > SLAB_MAXSIZE || objects[i] & (objects[i]-1)
+		|| sizes[i] > objects[i] || align > objects[i];
+	    starts[ns++] = slabs[i];
+	} else {
+	    bad |= restore_block(mm, ranges + m++, offsets[i], sizes[i],
+				 align) == ERROR;
+	}
+    }
+    if(ns){
+	qsort(starts, ns, sizeof(*starts), compare_offsets);
+    }
+    for(i = j = 0; i<ns; i++){
+	if(j == 0 || starts[i] != starts[j-1]){
+	    starts[j++] = starts[i];
+	}
+    }
+    for(ns = j, j = 0; j<ns; j++){
+	classes[j] = ERROR;
+	bad |= restore_block(mm, ranges + m++, starts[j], SLAB_SIZE,
+			     SLAB_ALIGN) == ERROR;
+    }
+
+    /* the objects of a slab are all of one class, and each is one of its
+     * slab's own */
+    for(i = 0; !bad && i<n; i++){
+	if(slabs && slabs[i]){
+	    at = bsearch(slabs + i, starts, ns, sizeof(*starts),
+			 compare_offsets);
+	    j = slab_of[i] = at - starts;
+	    c = slab_class(objects[i]);
+	    if(classes[j] == ERROR){
+		classes[j] = c;
+	    }
+	    taken[nt].start = offsets[i];
+	    taken[nt++].len = objects[i];
+	    bad |= c != classes[j] || offsets[i] < slabs[i]
+		|| offsets[i]-slabs[i] >= SLAB_SIZE
+		|| (offsets[i]-slabs[i]) & (objects[i]-1);
+	}
+    }
+    bad = bad || overlapping(ranges, m) || overlapping(taken, nt)
+	|| slab_spares(mm, ns) == ERROR
+	|| (mm->policy == MM_POLICY_TAGS
+	    && tags_restore(mm, ranges, m) == ERROR);
+
+    if(!bad){
+	/* from here on, classes[] holds the record of each slab. the lowest
+	 * slab of a class ends up first to hand out objects */
+	for(j = ns-1; j>=0; j--){
+	    classes[j] = slab_record(mm, starts[j], classes[j]);
+	    mark_range(mm, starts[j], SLAB_SIZE, 1);
+	    if(mm->policy == MM_POLICY_BUDDY){
+		buddy_claim(mm, starts[j], SLAB_SIZE);
+	    }
+	}
+	for(i = 0; i<n; i++){
+	    mm->vars[i] = mm->memory + offsets[i];
+	    mm->var_sizes[i] = sizes[i];
+	    mm->var_align[i] = aligns ? __builtin_ctzll(aligns[i]) : 0;
+	    mark_var(mm, i, 1);
+	    dirty_var(mm, i);
+	    slot_insert(mm, offsets[i], i);
+	    if(slab_of[i] != ERROR){
+		slab_claim(mm, classes[slab_of[i]], offsets[i], i);
+		continue;
+	    }
+	    mark_range(mm, offsets[i], sizes[i], 1);
+	    if(mm->policy == MM_POLICY_BUDDY){
+		buddy_claim(mm, offsets[i], var_span(mm, i));
+	    }
+	}
+	if(mm->policy != MM_POLICY_BUDDY && mm->policy != MM_POLICY_BITMAP
+	   && mm->policy != MM_POLICY_TAGS){
+	    rebuild_extents(mm, ranges, m);
+	}
+    }
+    free(ranges);
+    free(taken);
+    free(starts);
+    free(slab_of);
+    free(classes);
+    return bad ? ERROR : SUCCESS;
+}
+
+#ifdef MM_STATS
+
+/****************************************************************/
+
+/* a cheap timestamp: the cycle counter where there is one, nanoseconds
+ * otherwise.
+ */
+static uint64_t
+stats_clock(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+#endif
+}
+
+/****************************************************************/
+
+/* count one operation that took the cycles since t0 into the power of two
+ * bucket of hist it falls in.
+ */
+static void
+stats_time(uint64_t *hist, uint64_t t0){
+    uint64_t cycles = stats_clock() - t0;
+    int b = 63 - __builtin_clzll(cycles | 1);
+    hist[b < STATS_BUCKETS ? b : STATS_BUCKETS-1]++;
+}
+
+/****************************************************************/
+
+/* print everything counted for mm so far, with the free space as it
+ * stands now.
+ */
+static void
+stats_report(mmanager_t *mm, FILE *fp){
+    mm_stats_t *s = &mm->stats;
+    size_t total, largest, holes;
+    int b;
+
+    free_stats(mm, &total, &largest, &holes);
+    fprintf(fp, "Stats: %s policy, %lu of %lu bytes free, largest free "
+	    "block %lu, %lu holes\n", policies[mm->policy].name,
+	    (unsigned long)total, (unsigned long)mm->totalmem,
+	    (unsigned long)largest, (unsigned long)holes);
+    fprintf(fp, "  live bytes %lu, high-water %lu, highest end %lu, "
+	    "grown %lu times\n", (unsigned long)s->live_bytes,
+	    (unsigned long)s->peak_bytes, (unsigned long)s->high_end,
+	    (unsigned long)s->grows);
+    fprintf(fp, "  mallocs %lu (%lu failed), frees %lu (%lu failed)\n",
+	    (unsigned long)s->mallocs, (unsigned long)s->malloc_fails,
+	    (unsigned long)s->frees, (unsigned long)s->free_fails);
+    fprintf(fp, "  reallocs %lu (%lu moved), compactions %lu (%lu bytes "
+	    "moved)\n", (unsigned long)s->reallocs,
+	    (unsigned long)s->realloc_moves, (unsigned long)s->compactions,
+	    (unsigned long)s->compact_moved);
+    fprintf(fp, "  select_var %lu (%lu full), select_address %lu, "
+	    "%lu extents or orders probed\n", (unsigned long)s->var_selects,
+	    (unsigned long)s->var_fails, (unsigned long)s->selects,
+	    (unsigned long)s->probes);
+    fprintf(fp, "  bitmap runs %lu (%lu too short), %lu bytes scanned, "
+	    "is_vacant %lu (%lu failed)\n", (unsigned long)s->runs,
+	    (unsigned long)s->runs_failed, (unsigned long)s->scanned,
+	    (unsigned long)s->vacant_checks, (unsigned long)s->vacant_fails);
+    fprintf(fp, "  aligned %lu, %lu bytes of padding left free in front "
+	    "of them\n", (unsigned long)s->aligned,
+	    (unsigned long)s->align_padding);
+    fprintf(fp, "  cycles\tmm_malloc\tmm_free\n");
+    for(b = 0; b<STATS_BUCKETS; b++){
+	if(s->malloc_cycles[b] || s->free_cycles[b]){
+	    fprintf(fp, "  >=%lu\t%lu\t%lu\n", 1UL<<b,
+		    (unsigned long)s->malloc_cycles[b],
+		    (unsigned long)s->free_cycles[b]);
+	}
+    }
+}
+#endif
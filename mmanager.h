@@ -0,0 +1,105 @@
+/* Memory manager library
+ *
+ * A small malloc and free of our own, over an arena reserved with mmap.
+ * Each manager is an instance of its own: create as many as are needed
+ * with mm_create() and pass the one wanted to every call. Free space is
+ * handed out by one of several placement policies, chosen when the
+ * manager is created. Small variables may instead be packed into slabs
+ * of one size class each, see mm_set_slabs().
+ *
+ * Variables can be refered to by address, or by handle, an index that
+ * stays the same when compaction moves the variable. A handle is turned
+ * into an address with mm_deref().
+ *
+ * A manager can keep track of the pages of its memory and the variables
+ * that have changed, so that a checkpoint need only save those, see
+ * mm_track_dirty().
+ *
+ * mt_malloc() and mt_free() are a thread-safe front end over a set of
+ * managers of their own, one arena per thread.
+ *
+ * Build with -pthread. Built with -DMM_STATS, a manager also counts and
+ * times what it does, see mm_stats_report().
+ */
+
+#ifndef MMANAGER_H
+#define MMANAGER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define MM_ERROR	-1
+#define MM_SUCCESS	1
+#define MM_POLICY_FIRST	0
+#define MM_POLICY_NEXT	1
+#define MM_POLICY_BEST	2
+#define MM_POLICY_WORST	3
+#define MM_POLICY_SEG	4
+#define MM_POLICY_BUDDY	5
+#define MM_POLICY_BITMAP 6
+#define MM_POLICY_TAGS	7
+#define MM_NPOLICIES	8
+#define MT_CLASSES	5	/* mt_malloc() caches sizes 16, 32, ..., 256 */
+#define MT_MINSIZE	16
+
+/* a manager, only ever handled through a pointer */
+typedef struct mmanager mmanager_t;
+
+/* setting up and tearing down */
+mmanager_t *mm_create(int policy, size_t totalmem, size_t maxmem,
+		      size_t growby, int maxvars);
+void mm_destroy(mmanager_t *mm);
+void mm_reset(mmanager_t *mm);
+void mm_set_compact(mmanager_t *mm, int percent);
+int mm_set_slabs(mmanager_t *mm, int on);
+
+/* variables by address */
+void *mm_malloc(mmanager_t *mm, size_t size);
+void *mm_malloc_aligned(mmanager_t *mm, size_t size, size_t align);
+int mm_free(mmanager_t *mm, void *ptr);
+void *mm_realloc(mmanager_t *mm, void *ptr, size_t size);
+
+/* variables by handle */
+int mm_halloc(mmanager_t *mm, size_t size);
+int mm_halloc_aligned(mmanager_t *mm, size_t size, size_t align);
+int mm_hfree(mmanager_t *mm, int h);
+int mm_hrealloc(mmanager_t *mm, int h, size_t size);
+void *mm_deref(mmanager_t *mm, int h);
+size_t mm_compact(mmanager_t *mm);
+
+/* looking inside */
+char *mm_memory(mmanager_t *mm);
+size_t mm_size(mmanager_t *mm);
+int mm_maxvars(mmanager_t *mm);
+size_t mm_var(mmanager_t *mm, int i, void **ptr);
+size_t mm_var_slab(mmanager_t *mm, int i, size_t *object);
+int mm_slabs(mmanager_t *mm);
+char *mm_policy_name(mmanager_t *mm);
+int mm_find_policy(char *name);
+int mm_grow(mmanager_t *mm, size_t size);
+int mm_restore(mmanager_t *mm, size_t *offsets, size_t *sizes,
+	       size_t *aligns, size_t *slabs, size_t *objects, int n);
+void mm_free_stats(mmanager_t *mm, size_t *total, size_t *largest,
+		   size_t *holes);
+void mm_report(mmanager_t *mm, FILE *fp);
+void mm_stats_report(mmanager_t *mm, FILE *fp);
+
+/* what has changed, for incremental checkpoints */
+int mm_track_dirty(mmanager_t *mm, int on);
+void mm_touch(mmanager_t *mm, void *ptr, size_t len);
+size_t mm_next_dirty(mmanager_t *mm, size_t *offset);
+int mm_next_dirty_var(mmanager_t *mm, int i);
+
+/* zeroed arrays, for callers as much as for managers, that are NULL when
+ * there is no memory for them */
+void *mm_new_array(size_t n, size_t size);
+void *mm_grow_array(void *array, size_t n, size_t more, size_t size);
+
+/* the thread-safe front end */
+int mt_init(int narenas, size_t arena_size, int maxvars, int policy);
+void mt_destroy(void);
+void *mt_malloc(size_t size);
+void mt_free(void *ptr);
+void mt_flush(void);
+
+#endif
@@ -10,59 +10,492 @@
  * structure variable globally.
  * When a user puts an invalid input line in stdin, this program gives an
  * appropriate error message on the screen and exits.
+ *
+ * Usage: proj2 [-p policy] [-m bytes] [-M bytes] [-g bytes] [-v count]
+ *	[-T ops] [-s] [-z] [-x core_sparse] [-r] [-G trace] [-b trace]
+ *	[-C compiled] [-F percent] [-S] [-P] [-c] [-l align] [-K count]
+ *	[-X core_log] [-Y core_log] [-j threads] [file ...]
+ *   -p	placement policy used to pick free space, first-fit by default.
+ *	buddy replaces the free-extent list with a binary buddy system and
+ *	reports its internal fragmentation on exit. bitmap places like
+ *	first-fit but searches the occupancy bitmap instead of extents.
+ *	tags puts a header and footer around every block in the arena, so
+ *	a free merges with its neighbours at once, and reports what the
+ *	tags cost on exit.
+ *   -m	arena size, TOTALMEM by default
+ *   -M	size the arena may grow to when it runs out of space, -m by default
+ *   -g	how much to grow the arena by at a time, TOTALMEM by default
+ *   -v	number of variables that can be live at once, MAXVARS by default
+ *	sizes may end in k, m or g. The arena is reserved with mmap and
+ *	only touched pages are committed.
+ *   -T	instead of reading commands, benchmark the thread-safe allocator
+ *	(mt_malloc and mt_free) with this many operations per thread on
+ *	1, 2, 4, 8 and 16 threads
+ *   -s	dump only the live variables, to core_sparse, at the end
+ *   -z	like -s, but run-length encode variables where that helps
+ *   -x	instead of reading commands, expand the sparse dump named into
+ *	core_mem, core_vars and core_cmds; bytes of freed variables come
+ *	back as zero
+ *   -r	start from the core_mem, core_vars and core_cmds (or, with -s,
+ *	the core_sparse) of an earlier run rather than from empty memory.
+ *	restored variables keep the numbers of the commands that stored
+ *	them, and commands are numbered on from where that run stopped,
+ *	so its commands can be carried on as if it had never stopped
+ *   -G	instead of reading commands, write the trace described to
+ *	stdout as commands. a trace is a list such as
+ *	n=100000,seed=1,min=4,max=256,sizes=uniform,free=40,life=random,
+ *	live=1000,pattern=none. sizes may be uniform, skewed (towards
+ *	min) or bimodal; life says which allocation a free picks, random,
+ *	fifo or lifo; pattern may be holes or sawtooth to stress placement
+ *   -b	replay the trace described straight against mm_malloc() and
+ *	mm_free() and print one tab separated line of timings and
+ *	fragmentation
+ *   -C	instead of running the commands read, compile them to the file
+ *	named. a compiled trace keeps each command as an opcode, a length
+ *	and its chars or little-endian ints, and given in place of a file
+ *	of commands, is run straight from the mapped file without any
+ *	parsing, to the same report, warnings and dump. it must be a file,
+ *	not a pipe
+ *   -F	compact memory whenever a free leaves it this many percent
+ *	fragmented, or when an allocation finds no room
+ *   -S	stream: read any number of commands rather than stopping after
+ *	MAXLINES. only live variables are remembered either way
+ *   -P	pipeline: parse commands on one thread while running them on
+ *	another, and write the report while memory is dumped. the results
+ *	are the same either way. no effect with -j
+ *   -c	carve variables of up to 128 bytes, most c strings, from slabs of
+ *	4096 bytes that each hold objects of one size: 8, 16, 32, 64 or
+ *	128 bytes. small variables are packed together and found in O(1);
+ *	how full the slabs are is reported on exit. dumps keep the slabs,
+ *	so a run restored from one needs -c too
+ *   -l	store the ints of d commands at offsets that are a multiple of
+ *	this, a power of two from sizeof(int) up to 64, so they can be
+ *	read a vector at a time. sizeof(int) by default. bytes skipped in
+ *	front of them stay free for later variables
+ *   -K	append a checkpoint to core_log every count commands, on SIGUSR2
+ *	and at the end; with 0 only the last two. the first checkpoint
+ *	of a run holds all of memory but pages that are all zero, and
+ *	each one after only the pages and variables that have changed
+ *   -X	instead of reading commands, replay the checkpoints of the log
+ *	named into the core_mem, core_vars and core_cmds of its last one
+ *   -Y	instead of reading commands, compact the log named into a
+ *	single checkpoint that replays to the same
+ *   -j	run every file named as a batch, on this many threads, each with
+ *	a manager of its own. the report of file goes to file.out and its
+ *	dump to file.core_mem, file.core_vars and file.core_cmds (or
+ *	file.core_sparse), and its checkpoints to file.core_log; a file
+ *	with bad commands fails on its own. prints how long it took
+ *   file	read commands from file rather than stdin
+ *
+ * Besides c, d and f, the command r<cmd#>,<values> appends chars or ints
+ * to what an earlier c or d command stored, resizing it with mm_realloc,
+ * and a lone k compacts memory. Commands hold handles rather than
+ * addresses, so variables can be moved under them.
+ *
+ * Built with -DMM_STATS, the allocator also counts and times what it does
+ * and prints a summary to stderr on exit, or after the current command
+ * when it gets SIGUSR1.
+ *
+ * The allocator itself is the library in mmanager.c, see mmanager.h; this
+ * file only drives it. Build the two together with -pthread, e.g.
+ *	cc -pthread -o proj2 my_answer_to_proj2.c mmanager.c
  * 
  * Algorithms are fun!
  */
 
+#define _DEFAULT_SOURCE		/* madvise(), getsubopt() under -std=c99 */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sched.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "mmanager.h"
 
-#define TOTALMEM	1048576
-#define MAXVARS		1024
-#define ERROR		-1
-#define SUCCESS		1
+#define ERROR		MM_ERROR	/* what the library returns too */
+#define SUCCESS		MM_SUCCESS
+#define TOTALMEM	1048576	/* default arena size */
+#define MAXVARS		1024	/* default number of variables */
+#define PAGESIZE	4096	/* arena sizes are whole pages */
 #define LINELEN		5000
+#define READBUF		(1<<20)	/* bytes read from a pipe at a time */
+#define WRITEBUF	(1<<16)	/* bytes of output written at a time */
 #define MAXLINES	100000
 #define INPUT_INTS	'd'
 #define INPUT_CHARS	'c'
 #define FREE_DATA	'f'
-#define INT_DELIM_S	","
+#define RESIZE_DATA	'r'
+#define COMPACT_DATA	'k'
 #define INT_DELIM_C	','
+#define ERROR_DIGITS	(~(uint64_t)0)	/* see digits8() */
+#define NOT_INT		-1	/* see scan_integers() */
+#define INT_TOO_LARGE	-2
+#define SPARSE_MAGIC	"MMSPARSE"	/* first bytes of a sparse dump */
+#define SPARSE_VERSION	3
+#define SPARSE_HEADER	40	/* bytes in its header */
+#define SPARSE_ENTRY	64	/* bytes per variable in its table */
+#define SPARSE_ENTRY_V2	48	/* and before slabs were kept */
+#define SPARSE_RAW	0	/* a variable's bytes are stored as they are */
+#define SPARSE_RLE	1	/* or run-length encoded, see rle_encode() */
+#define LOG_MAGIC	"MMCHKPNT"	/* first bytes of every checkpoint */
+#define LOG_VERSION	3
+#define LOG_HEADER	48	/* bytes in the header of a checkpoint */
+#define LOG_RUN		16	/* bytes in front of each run of memory */
+#define LOG_VAR		44	/* bytes per variable */
+#define LOG_VAR_V2	28	/* and before slabs were kept */
+#define COMPILED_MAGIC	"MMCMDBIN"	/* first bytes of a compiled trace */
+#define COMPILED_VERSION 2
+#define COMPILED_HEADER	12	/* bytes in its header */
+#define COMPILED_OP	5	/* bytes of opcode and length per command */
+#define COMPILED_LINE	0	/* the opcode of a line kept as text */
+#define COMPILED_WARNING 1	/* and of the chars lost from the next line */
+#define COMPILED_MAXLEN	(2*LINELEN+12)	/* most payload a command has */
+#define MT_MAXTHREADS	16	/* the benchmark goes up to this many */
+#define MT_WINDOW	256	/* live blocks per benchmark thread */
+#define MT_ARENASIZE	(16*TOTALMEM)
+#define MT_ARENAVARS	(64*MAXVARS)
+#define BATCH_MAXTHREADS 64	/* most threads -j may ask for */
+#define PIPE_SLOTS	64	/* commands the parser may run ahead by */
+#define MAX_INT_ALIGN	64	/* most -l may ask for */
+
+#define TRACE_UNIFORM	0	/* sizes of a generated trace, see trace_size() */
+#define TRACE_SKEWED	1
+#define TRACE_BIMODAL	2
+#define TRACE_RANDOM	0	/* which live allocation a free picks */
+#define TRACE_FIFO	1
+#define TRACE_LIFO	2
+#define TRACE_NONE	0	/* adversarial patterns, see gen_trace() */
+#define TRACE_HOLES	1
+#define TRACE_SAWTOOTH	2
+
+/* where input lines come from: a mapped file, or a buffer refilled
+ * from a pipe or terminal
+ */
+typedef struct {
+	int fd;
+	char *buf;		/* the input, or a window onto it */
+	size_t len;		/* bytes of buf holding input */
+	size_t cap;		/* size of buf */
+	size_t pos;		/* start of the next line in buf */
+	int mapped;		/* buf is the whole file, mapped */
+	int eof;		/* nothing more to read into buf */
+} reader_t;
+
+/* what kind of commands gen_trace() makes */
+typedef struct {
+	int n;			/* commands in all */
+	uint64_t seed;
+	int min, max;		/* bytes per allocation */
+	int sizes;		/* TRACE_UNIFORM, _SKEWED or _BIMODAL */
+	int freepct;		/* chance in a hundred a command is a free */
+	int life;		/* TRACE_RANDOM, _FIFO or _LIFO */
+	int maxlive;		/* allocations live at once */
+	int pattern;		/* TRACE_NONE, _HOLES or _SAWTOOTH */
+} trace_spec_t;
+
+/* one generated command */
+typedef struct {
+	char cmd;		/* INPUT_CHARS, INPUT_INTS or FREE_DATA */
+	int size;		/* bytes to allocate */
+	int target;		/* the command whose allocation is freed */
+} trace_op_t;
+
+/* where expand_sparse() rebuilds what core_dump() writes */
+typedef struct {
+	char *memory;		/* image of core_mem */
+	FILE *vars_fptr;	/* core_vars, written as variables are met */
+	FILE *cmds_fptr;	/* and core_cmds */
+} expand_t;
+
+/* what a checkpoint holds, see write_checkpoint() */
+typedef struct {
+	int full;		/* everything, rather than what has changed */
+	int commands;		/* run before it was taken */
+	int maxvars;
+	size_t totalmem;
+	char *memory;		/* where the bytes of the runs come from */
+	size_t *runs;		/* offset and length of each run of memory */
+	int nruns;
+	int *vars;		/* the index of each variable in it */
+	size_t *offsets, *sizes;	/* and where it is, size 0 if free */
+	size_t *slabs, *objects;	/* where its slab starts, 0 if none,
+					 * and how big the slab's objects are */
+	int *cmds;		/* the command that stored it */
+	char *types;		/* and what that stored */
+	int nvars;
+} checkpoint_t;
+
+/* what replay_log() has rebuilt from the checkpoints so far */
+typedef struct {
+	char *memory;		/* image of core_mem */
+	size_t totalmem;	/* bytes of it in use */
+	size_t cap;		/* bytes of it there are */
+	size_t *offsets, *sizes;	/* of each variable, size 0 if free */
+	size_t *slabs, *objects;	/* where its slab starts, 0 if none,
+					 * and how big the slab's objects are */
+	int *cmds;		/* the command that stored it */
+	char *types;		/* and what that stored */
+	int maxvars;
+	int commands;		/* run when the last was taken */
+} log_state_t;
+
+/* one variable of a sparse dump, as read_sparse() hands it on */
+typedef struct {
+	size_t offset, size;
+	size_t slab, object;	/* where its slab starts, 0 if none, and
+				 * how big the slab's objects are */
+	int cmd;		/* the command that stored it */
+	char type;		/* INPUT_CHARS or INPUT_INTS */
+	unsigned char *data;	/* its bytes */
+} dump_var_t;
+
+/* where load_core() and load_sparse() collect the variables they
+ * restore, see finish_restore()
+ */
+typedef struct {
+	mmanager_t *mm;
+	size_t *offsets;	/* of each variable so far */
+	size_t *sizes;
+	size_t *slabs, *objects;	/* where its slab starts, 0 if none,
+					 * and how big the slab's objects are */
+	int *cmds;		/* the command that stored it */
+	char *types;		/* and what that stored */
+	int n;			/* how many so far */
+	int commands;		/* run before the dump was taken */
+} restore_t;
+
+/* a buffer that report output is gathered in and written out from */
+typedef struct {
+	int fd;
+	char *buf;		/* WRITEBUF bytes */
+	size_t len;		/* bytes waiting to be written */
+} writer_t;
+
+/* what is known about the variable an earlier c or d command stored */
+typedef struct {
+	int cmd;		/* the command's number, counting from 0 */
+	char type;		/* INPUT_CHARS or INPUT_INTS */
+	int handle;		/* from mm_halloc(), ERROR once freed */
+	int len;		/* chars, with the '\0', or ints stored */
+} record_t;
+
+/* the records of the live variables, in order of command number */
+typedef struct {
+	record_t *recs;
+	int n;			/* records in use, freed ones included */
+	int cap;		/* records there is room for */
+	int dead;		/* freed ones not yet squeezed out */
+} records_t;
+
+/* what every set of commands is run with, from the command line */
+typedef struct {
+	int policy;		/* see mm_create() */
+	size_t totalmem, maxmem, growby;
+	int maxvars;
+	int compact;		/* see mm_set_compact() */
+	int sparse, compress;	/* dump to core_sparse, run-length encoded */
+	int restore;		/* start from an earlier dump */
+	int streaming;		/* read past MAXLINES commands */
+	int pipelined;		/* parse on a thread of its own */
+	int slabs;		/* see mm_set_slabs() */
+	int logging;		/* keep a log of checkpoints */
+	int every;		/* commands between them, 0 for only on
+				 * SIGUSR2 and at the end */
+} settings_t;
 
+/* one run of commands: a file of a batch, or the only one */
 typedef struct {
-	char memory[TOTALMEM];	/* TOTALMEM bytes of memory */
-	void *null;		/* first address will be  unusable */
-	void *vars[MAXVARS];	/* MAXVARS variables, each at an address */
-	size_t var_sizes[MAXVARS];	/* number of bytes per variable */
-} mmanager_t;
+	char *name;		/* the file they come from */
+	int in, out;		/* its descriptor and the report's */
+	reader_t input;
+	writer_t output;
+	records_t recs;
+	int commands;		/* how many have been run */
+	int failed;		/* gave up part way, see give_up() */
+	mmanager_t *mm;		/* its manager, for report_thread() */
+	FILE *log;		/* where checkpoints go, NULL if none are kept */
+	int every;		/* see settings_t */
+	int checkpoints;	/* written so far */
+	int signals;		/* checkpoint_signals at the last */
+} job_t;
 
-mmanager_t manager;
+/* a command as the parser thread of a pipelined run passes it on */
+typedef struct {
+	int len;		/* chars in the line, ERROR after the last */
+	int oversize;		/* chars it was cut short by */
+	int numInts, intsLen;	/* see parse_integers(), ERROR if the line
+				 * is passed on as it is */
+	union {
+		char line[LINELEN];
+		int ints[LINELEN/2+1];
+	} u;
+} pipe_cmd_t;
+
+/* the commands of a pipelined run that have been parsed but not yet run.
+ * head is written only by the allocating thread and tail only by the
+ * parser, each on a cache line of its own and through the __atomic
+ * builtins.
+ */
+typedef struct {
+	int head __attribute__((aligned(64)));	/* next to run */
+	int tail __attribute__((aligned(64)));	/* next to fill */
+	reader_t *input;	/* where the parser reads from */
+	int streaming;		/* read past MAXLINES commands */
+	int lines;		/* or how many there are left of them */
+	pipe_cmd_t slots[PIPE_SLOTS];
+} pipe_t;
+
+/* the files one batch thread has left to run, on cache lines of its own */
+typedef struct queue {
+	pthread_mutex_t lock;
+	int head, tail;		/* its files are jobs[head] to jobs[tail-1] */
+	struct batch *batch;	/* the batch it belongs to */
+	int id;			/* and which of its threads takes from it */
+} __attribute__((aligned(64))) queue_t;
+
+/* what the threads of a batch share */
+typedef struct batch {
+	settings_t *set;
+	job_t *jobs;		/* one per file */
+	queue_t *queues;	/* one per thread */
+	int nthreads;
+} batch_t;
+
+__thread mmanager_t *manager;	/* each batch thread has its own */
+__thread jmp_buf *job_exit;	/* where give_up() goes in a batch */
+void *mt_handoff[MT_WINDOW];	/* benchmark blocks in transit */
+size_t int_align = sizeof(int);	/* where d commands are stored, see -l */
+volatile sig_atomic_t checkpoint_signals = 0;	/* SIGUSR2s so far */
 
 /****************************************************************/
 
 /* function prototypes */
-int read_line(char *line, int maxlen);
-void process_input_char(char *line, char *commands, void *stored[],
-			int *storeLen, int numCommands);
-void process_input_int(char *line, char *commands, void *stored[],
-		       int *storeLen, int numCommands);
-void process_free(char *line, char *commands, void *stored[],
-		  int *storeLen, int numCommands);
-int count_char(char c, char *s);
-int parse_free(char* line, void* stored[], int numCommands);
-int parse_integers(char *str, char *delim, int results[], int max_results);
-void print_ints(int *intArray, size_t size);
-void print_chars(char *charArray);
-void print_memory(char isInt[MAXVARS]);
-void *mm_malloc(size_t size);
-void mm_free(void *ptr);
-int is_vacant(void *first, void* last);
-void *select_address(size_t size);
-int select_var(void);
-void core_dump(char *filename_mem, char*filename_vars);
+void new_manager(settings_t *set, job_t *job, char *prefix);
+char *dump_name(char *name, char *prefix, char *file);
+void run_commands(settings_t *set, job_t *job, char *prefix);
+void run_command(char *line, int len, job_t *job);
+void end_command(job_t *job);
+void write_report(mmanager_t *mm, job_t *job);
+void *report_thread(void *arg);
+void dump_memory(settings_t *set, job_t *job, char *prefix);
+void run_pipelined(settings_t *set, job_t *job);
+void *parse_thread(void *arg);
+int is_compiled(reader_t *r);
+void run_compiled(settings_t *set, job_t *job);
+void run_compiled_command(char op, unsigned char *data, int len, job_t *job);
+int compiled_ints(unsigned char *data, int len);
+const void *native_ints(unsigned char *p, int n, int *buf);
+void compile_trace(reader_t *r, int fd);
+char compile_command(char *line, int len, char *types, int n,
+		     unsigned char *payload, int *size);
+int compile_ints(char *str, int len, unsigned char *payload);
+int compiled_target(char *s, int len, int n);
+void free_job(job_t *job);
+void give_up(void);
+void *new_array(size_t n, size_t size);
+void *grow_array(void *array, size_t n, size_t more, size_t size);
+int run_batch(settings_t *set, char **files, int n, int threads);
+void *batch_worker(void *arg);
+int next_job(batch_t *batch, int id);
+void run_job(settings_t *set, job_t *job);
+void open_reader(reader_t *r, int fd);
+void fill_reader(reader_t *r);
+char *read_line(reader_t *r, int maxlen, int *len);
+char *next_line(reader_t *r, int maxlen, int *len, int *oversize);
+void process_input_char(char *line, int len, records_t *recs,
+			int numCommands);
+void process_input_int(char *line, int len, records_t *recs,
+		       int numCommands);
+void store_chars(char *chars, int len, records_t *recs, int numCommands);
+void store_ints(const void *ints, int numInts, int intsLen, records_t *recs,
+		int numCommands);
+void process_free(char *line, int len, records_t *recs, int numCommands);
+void free_record(records_t *recs, record_t *rec);
+record_t *parse_free(char* line, int len, records_t *recs, int numCommands);
+void process_resize(char *line, int len, records_t *recs, int numCommands);
+void append_chars(record_t *rec, char *chars, int more);
+void append_ints(record_t *rec, const void *ints, int numInts, int intsLen);
+void process_compact(char *line, int len);
+void add_record(records_t *recs, int cmd, char type, int h, int len);
+record_t *find_record(records_t *recs, int cmd);
+void drop_record(records_t *recs, record_t *rec);
+record_t **records_by_handle(records_t *recs, int maxvars);
+int compare_records(const void *a, const void *b);
+int parse_integers(char *str, int len, int results[], int *slots);
+int scan_integers(char *str, int len, int results[], int *slots, char **token,
+		  int *tokenLen);
+uint64_t digits8(char *s);
+int parse_int(char *s, int len, int *num);
+void print_ints(writer_t *w, int *intArray, size_t size);
+void print_chars(writer_t *w, char *charArray);
+void print_memory(writer_t *w, char isInt[]);
+void open_writer(writer_t *w, int fd);
+void flush_writer(writer_t *w);
+void put_str(writer_t *w, char *s, size_t len);
+void put_char(writer_t *w, char c);
+void put_int(writer_t *w, int num);
+void core_dump(char *filename_mem, char*filename_vars, char *filename_cmds,
+	       records_t *recs, int commands);
+void put_le(unsigned char *p, uint64_t v, int n);
+uint64_t get_le(unsigned char *p, int n);
+size_t rle_encode(unsigned char *src, size_t len, unsigned char *dst);
+int rle_decode(unsigned char *src, size_t len, unsigned char *dst,
+	       size_t size);
+void sparse_dump(char *filename, int compress, records_t *recs,
+		 int commands);
+int sparse_header(FILE *fp, char *filename, unsigned char *header);
+size_t read_sparse(char *filename, void (*put)(dump_var_t *v, void *arg),
+		   void *arg, int *commands);
+void expand_var(dump_var_t *v, void *arg);
+void expand_sparse(char *filename, char *filename_mem, char *filename_vars,
+		   char *filename_cmds);
+void fit_memory(mmanager_t *mm, size_t size, char *filename);
+void load_core(mmanager_t *mm, job_t *job, char *filename_mem,
+	       char *filename_vars, char *filename_cmds);
+void restore_var(dump_var_t *v, void *arg);
+void load_sparse(mmanager_t *mm, job_t *job, char *filename);
+void new_restore(restore_t *r, mmanager_t *mm);
+void finish_restore(restore_t *r, job_t *job, char *filename);
+void open_log(settings_t *set, job_t *job, char *prefix);
+void checkpoint(job_t *job);
+void add_run(checkpoint_t *c, size_t off, size_t len);
+void write_checkpoint(FILE *fp, checkpoint_t *c, char *filename);
+void replay_log(char *filename, log_state_t *s);
+void expand_log(char *filename, char *filename_mem, char *filename_vars,
+		char *filename_cmds);
+void compact_log(char *filename);
+void free_log_state(log_state_t *s);
+void checkpoint_signal(int sig);
+size_t parse_size(char *s);
+void *mt_bench_thread(void *arg);
+void mt_bench(long ops, int policy);
+uint64_t trace_rand(uint64_t *state);
+int parse_trace_spec(char *spec, trace_spec_t *ts);
+int trace_size(trace_spec_t *ts, uint64_t *state);
+trace_op_t *gen_trace(trace_spec_t *ts);
+void write_trace(trace_op_t *ops, int n, int fd);
+int compare_ns(const void *a, const void *b);
+void bench_trace(trace_op_t *ops, int n);
+#ifdef MM_STATS
+void stats_signal(int sig);
+
+/* set by SIGUSR1, see stats_signal() */
+volatile sig_atomic_t stats_wanted = 0;
+#endif
 
 
 /****************************************************************/
@@ -71,387 +504,3005 @@ void core_dump(char *filename_mem, char*filename_vars);
  */
 int
 main(int argc, char *argv[]) {
-    char line[LINELEN+1];
-    char cmd[MAXLINES];
-    void *stored[MAXLINES];
-    int storeLen[MAXLINES];
-    int i, numCmd = 0;
+    settings_t set = {.policy = MM_POLICY_FIRST, .totalmem = TOTALMEM,
+		      .growby = TOTALMEM, .maxvars = MAXVARS};
+    job_t job = {.in = STDIN_FILENO, .out = STDOUT_FILENO};
+    int opt, threads = 0, fd;
+    long benchOps = 0;
+    char *expand = NULL, *compile = NULL, *logFile = NULL;
+    int compactLog = 0;
+    trace_spec_t spec;
+    trace_op_t *trace = NULL;
+    int replay = 0;
+    size_t *size = NULL;
 
-    /* initialise our very own NULL */
-    manager.null = manager.memory;
-
-    /* process input commands that make use of memory management */
-    while (numCmd<MAXLINES && read_line(line,LINELEN)) {
-    	if (strlen(line) < 2) {
-	    fprintf(stderr, "Invalid line %s\n", line);
-  	    return EXIT_FAILURE;
+    /* choose how free space is handed out, first-fit unless asked,
+     * and how big the arena is
+     */
+    while ((opt = getopt(argc, argv, "p:m:M:g:v:T:szx:rG:b:C:F:Sj:Pcl:K:X:Y:")) != -1) {
+	if (opt == 'p' && (set.policy = mm_find_policy(optarg)) != ERROR) {
+	    continue;
 	}
-	
-	if (line[0] == INPUT_CHARS) {
-	    process_input_char(line, cmd, stored, storeLen, numCmd);
-	} else if (line[0] == INPUT_INTS) {
- 	    process_input_int(line, cmd, stored, storeLen, numCmd);
-	} else if (line[0] == FREE_DATA) {
-	    process_free(line, cmd, stored, storeLen, numCmd);
-	} else {
-	    fprintf(stderr, "Invalid input %c.\n", line[0]);
-	    return EXIT_FAILURE;
+	size = opt == 'm' ? &set.totalmem : opt == 'M' ? &set.maxmem
+	    : opt == 'g' ? &set.growby : NULL;
+	if (size && (*size = parse_size(optarg)) > 0) {
+	    continue;
 	}
-	
-	numCmd++;
+	if (opt == 'v' && (set.maxvars = atoi(optarg)) > 0) {
+	    continue;
+	}
+	if (opt == 'T' && (benchOps = atol(optarg)) > 0) {
+	    continue;
+	}
+	if (opt == 's' || opt == 'z') {
+	    set.sparse = 1;
+	    set.compress |= opt == 'z';
+	    continue;
+	}
+	if (opt == 'x') {
+	    expand = optarg;
+	    continue;
+	}
+	if (opt == 'C') {
+	    compile = optarg;
+	    continue;
+	}
+	if (opt == 'K' && isdigit((unsigned char)optarg[0])) {
+	    set.logging = 1;
+	    set.every = atoi(optarg);
+	    continue;
+	}
+	if (opt == 'X' || opt == 'Y') {
+	    logFile = optarg;
+	    compactLog = opt == 'Y';
+	    continue;
+	}
+	if (opt == 'r') {
+	    set.restore = 1;
+	    continue;
+	}
+	if (opt == 'S') {
+	    set.streaming = 1;
+	    continue;
+	}
+	if (opt == 'P') {
+	    set.pipelined = 1;
+	    continue;
+	}
+	if (opt == 'c') {
+	    set.slabs = 1;
+	    continue;
+	}
+	if (opt == 'l' && (int_align = atoi(optarg)) >= sizeof(int)
+	    && int_align <= MAX_INT_ALIGN && !(int_align & (int_align-1))) {
+	    continue;
+	}
+	if (opt == 'F' && (set.compact = atoi(optarg)) > 0
+	    && set.compact <= 100) {
+	    continue;
+	}
+	if ((opt == 'G' || opt == 'b')
+	    && parse_trace_spec(optarg, &spec) == SUCCESS) {
+	    trace = gen_trace(&spec);
+	    replay = opt == 'b';
+	    continue;
+	}
+	if (opt == 'j' && (threads = atoi(optarg)) > 0
+	    && threads <= BATCH_MAXTHREADS) {
+	    continue;
+	}
+	fprintf(stderr, "Usage: %s [-p first|next|best|worst|seg|buddy|bitmap"
+		"|tags] [-m bytes] [-M bytes] [-g bytes] [-v count] [-T ops]"
+		" [-s] [-z] [-x core_sparse] [-r] [-G trace] [-b trace]"
+		" [-C compiled] [-F percent] [-S] [-P] [-c] [-l align]"
+		" [-K count] [-X core_log] [-Y core_log] [-j threads]"
+		" [file ...]\n", argv[0]);
+	return EXIT_FAILURE;
     }
 
-    /* print out what we are left with
-     * after creating variables, deleting some, creating more, ...
-     */
-    printf("Cmd#\tOffset\tValue\n");
-    printf("====\t======\t=====\n");
-    for (i=0; i<numCmd; i++) {
-	if (storeLen[i] > 0) {
-	    printf("%d\t%d\t", i, (int)((char*)stored[i]-manager.memory));
-	    if (cmd[i] == INPUT_CHARS) {
-		print_chars((char*)stored[i]);
-	    } else {
-		print_ints((int*)stored[i], storeLen[i]);
-	    }
-	}
+    if (set.logging) {
+	signal(SIGUSR2, checkpoint_signal);
     }
-    /* call core_dump */
-    core_dump("core_mem", "core_vars");
-    return 0;
-}
 
-/****************************************************************/
+    /* a batch runs every file named on threads of its own */
+    if (threads > 0) {
+	return run_batch(&set, argv+optind, argc-optind, threads);
+    }
+    if (optind < argc && (job.in = open(argv[optind], O_RDONLY)) < 0) {
+	perror(argv[optind]);
+	return EXIT_FAILURE;
+    }
 
-/* read in a line of input
- */
-int
-read_line(char *line, int maxlen) {
-    int n = 0;
-    int oversize = 0;
-    int c;
-    while (((c=getchar())!=EOF) && (c!='\n')) {
-	if (n < maxlen) {
-	    line[n++] = c;
-	}
-	else {
-	    oversize++;
-	}
+    /* a generated trace is written out instead of being run */
+    if (trace && !replay) {
+	write_trace(trace, spec.n, STDOUT_FILENO);
+	free(trace);
+	return 0;
     }
-    line[n] = '\0';
-    if (oversize > 0) {
-	fprintf(stderr, "Warning! %d over limit. Line truncated.\n", 
-	    oversize);
+
+    /* and commands to be compiled are not run either */
+    if (compile) {
+	if ((fd = open(compile, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+	    perror(compile);
+	    return EXIT_FAILURE;
 	}
-    return ((n>0) || (c!=EOF));
+	open_reader(&job.input, job.in);
+	compile_trace(&job.input, fd);
+	close(fd);
+	free_job(&job);
+	return 0;
+    }
+
+    /* neither does expanding a sparse dump */
+    if (expand) {
+	expand_sparse(expand, "core_mem", "core_vars", "core_cmds");
+	return 0;
+    }
+
+    /* nor does replaying or compacting a log of checkpoints */
+    if (logFile && compactLog) {
+	compact_log(logFile);
+	return 0;
+    } else if (logFile) {
+	expand_log(logFile, "core_mem", "core_vars", "core_cmds");
+	return 0;
+    }
+
+    /* the thread scaling benchmark does not read any commands */
+    if (benchOps > 0) {
+	mt_bench(benchOps, set.policy);
+	return 0;
+    }
+
+#ifdef MM_STATS
+    signal(SIGUSR1, stats_signal);
+#endif
+
+    /* replay a generated trace without going through the commands */
+    if (replay) {
+	new_manager(&set, &job, "");
+	bench_trace(trace, spec.n);
+#ifdef MM_STATS
+	mm_stats_report(manager, stderr);
+#endif
+	free(trace);
+	return 0;
+    }
+
+    /* or process input commands that make use of memory management */
+    run_commands(&set, &job, "");
+    free_job(&job);
+    return 0;
 }
 
 /****************************************************************/
 
-/* process an input-char command from stdin by storing the string
+/* set up the arena of this thread's manager, including our very own NULL,
+ * and carry on from where the last dump named with prefix left off if
+ * asked to.
  */
 void
-process_input_char(char *line, char *commands, void *stored[], 
-		   int *storeLen, int numCommands) {
-    size_t lineLen = strlen(line);
-    commands[numCommands] = line[0];
-    stored[numCommands] = mm_malloc(lineLen);
-    assert(stored[numCommands] != manager.null);
-    strcpy(stored[numCommands], line+1);
-    storeLen[numCommands] = lineLen;
+new_manager(settings_t *set, job_t *job, char *prefix) {
+    char name[PATH_MAX], vars[PATH_MAX], cmds[PATH_MAX];
+
+    manager = mm_create(set->policy, set->totalmem, set->maxmem,
+			set->growby, set->maxvars);
+    if (!manager) {
+	fprintf(stderr, "Cannot reserve %lu bytes of memory.\n",
+		(unsigned long)(set->maxmem > set->totalmem
+				? set->maxmem : set->totalmem));
+	give_up();
+    }
+    mm_set_compact(manager, set->compact);
+    if (mm_set_slabs(manager, set->slabs) == ERROR) {
+	fprintf(stderr, "Out of memory.\n");
+	give_up();
+    }
+
+    if (set->restore && set->sparse) {
+	load_sparse(manager, job, dump_name(name, prefix, "core_sparse"));
+    } else if (set->restore) {
+	load_core(manager, job, dump_name(name, prefix, "core_mem"),
+		  dump_name(vars, prefix, "core_vars"),
+		  dump_name(cmds, prefix, "core_cmds"));
+    }
 }
 
 /****************************************************************/
 
-/* process an input-int command from stdin by storing the ints
+/* the name of a dump file: file itself, or file after prefix, the name
+ * of the input and a dot, in a batch. name must hold PATH_MAX chars.
  */
-void
-process_input_int(char *line, char *commands, void *stored[], 
-		  int *storeLen, int numCommands) {
-    int intsLen = count_char(INT_DELIM_C, line+1) + 1;
-    size_t size = sizeof(intsLen) * intsLen;
-    commands[numCommands] = line[0];
-    stored[numCommands] = mm_malloc(size);
-    assert(stored[numCommands] != manager.null);
-    parse_integers(line+1, INT_DELIM_S, stored[numCommands], intsLen);
-    storeLen[numCommands] = intsLen;
+char *
+dump_name(char *name, char *prefix, char *file) {
+    if (snprintf(name, PATH_MAX, "%s%s", prefix, file) >= PATH_MAX) {
+	fprintf(stderr, "Name too long %s%s.\n", prefix, file);
+	give_up();
+    }
+    return name;
 }
 
 /****************************************************************/
 
-/* process a free command from stdin
+/* run the commands read from job->in against a fresh manager, write what
+ * memory is left holding to job->out, then dump it to files whose names
+ * start with prefix. resources are kept in job, so that free_job() can
+ * give them back even if this gives up part way.
  */
 void
-process_free(char *line, char *commands, void *stored[], 
-	     int *storeLen, int numCommands) {
+run_commands(settings_t *set, job_t *job, char *prefix) {
+    pthread_t writer;
+    char *line;
+    int len;
 
-    int f_num;
-    /* check if it is a valid command */
-    f_num = parse_free(line+1, stored, numCommands);
-    
-    commands[numCommands] = line[0];
-    stored[numCommands] = manager.null;
-    storeLen[numCommands] = 0;
+    new_manager(set, job, prefix);
+    if (set->logging) {
+	open_log(set, job, prefix);
+    }
+    open_reader(&job->input, job->in);
+    if (is_compiled(&job->input)) {
+	run_compiled(set, job);
+    } else if (set->pipelined) {
+	run_pipelined(set, job);
+    } else {
+	while ((set->streaming || job->commands<MAXLINES)
+	       && (line = read_line(&job->input, LINELEN, &len))) {
+	    run_command(line, len, job);
+	}
+    }
+    if (job->log) {
+	checkpoint(job);
+    }
 
-    /* call mm_free to free the allocated memory */
-    mm_free(stored[f_num-1]);
-    
-    stored[f_num-1] = manager.null;
-    storeLen[f_num-1] = 0;	
+    if (set->pipelined) {
+	/* the report and the dump are written side by side */
+	job->mm = manager;
+	pthread_create(&writer, NULL, report_thread, job);
+	dump_memory(set, job, prefix);
+	pthread_join(writer, NULL);
+    } else {
+	write_report(manager, job);
+	dump_memory(set, job, prefix);
+    }
+    mm_report(manager, stderr);
+#ifdef MM_STATS
+    mm_stats_report(manager, stderr);
+#endif
 }
 
 /****************************************************************/
 
-/* Count the number of occurences of a char in a string
+/* run the command in the len chars of line, the next of job's.
  */
-int
-count_char(char c, char *s) {
-    int count = 0;
-    if (!s) {
-	return count;
+void
+run_command(char *line, int len, job_t *job) {
+    if (len < 2 && (len < 1 || line[0] != COMPACT_DATA)) {
+	fprintf(stderr, "Invalid line %.*s\n", len, line);
+	give_up();
     }
-    while (*s != '\0') {
-	if (*(s++) == c) {
-	    count++;
-	}
+	
+    if (line[0] == INPUT_CHARS) {
+	process_input_char(line, len, &job->recs, job->commands);
+    } else if (line[0] == INPUT_INTS) {
+	process_input_int(line, len, &job->recs, job->commands);
+    } else if (line[0] == FREE_DATA) {
+	process_free(line, len, &job->recs, job->commands);
+    } else if (line[0] == RESIZE_DATA) {
+	process_resize(line, len, &job->recs, job->commands);
+    } else if (line[0] == COMPACT_DATA) {
+	process_compact(line, len);
+    } else {
+	fprintf(stderr, "Invalid input %c.\n", line[0]);
+	give_up();
     }
-    return count;
+    end_command(job);
 }
 
 /****************************************************************/
 
-/* check if the number that 'f' command is followed by is valid or not.
- * If not valid, an error message appears on screen and the program exits. 
+/* count a command of job as done.
  */
-int
-parse_free(char* line, void* stored[], int numCommands){
-    int f_num = atoi(line);
-    int i;
-    
-    if(f_num <= 0){
-        fprintf(stderr, "Not available.\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    if(f_num > numCommands){
-    	fprintf(stderr, "The number should be less or equal than %d.\n"
-    		, numCommands);
-    	exit(EXIT_FAILURE);
+void
+end_command(job_t *job) {
+    if (job->commands == INT_MAX) {
+	fprintf(stderr, "Too many commands.\n");
+	give_up();
     }
-    
-    if(stored[f_num-1] == manager.null){
-    	fprintf(stderr, "The command was alreadly freed.\n");
-    	exit(EXIT_FAILURE);
+    job->commands++;
+    if (job->log && ((job->every > 0 && job->commands % job->every == 0)
+		     || job->signals != checkpoint_signals)) {
+	job->signals = checkpoint_signals;
+	checkpoint(job);
     }
-    
-    for(i = 0; i<strlen(line); i++){
-        if('0'>line[i] || '9'<line[i]){
-            fprintf(stderr,
-            	    "Neither spaces nor chars other than numbers allowed.\n");
-            exit(EXIT_FAILURE);
-        }
+#ifdef MM_STATS
+    if (stats_wanted) {
+	stats_wanted = 0;
+	mm_stats_report(manager, stderr);
     }
-    return f_num;
+#endif
 }
 
 /****************************************************************/
 
-/* parse string for a delimited-list of positive integers.
- * Returns number of ints parsed. If invalid input is detected
- * or if more than max_results ints are parsed, execution
- * will halt. Note! str will be modified as a side-effect of
- * running this function: delims replaced by \0
+/* print out what mm is left with, after creating variables, deleting
+ * some, creating more, ..., to job->out
  */
-int
-parse_integers(char *str, char *delim, int results[], int max_results) {
-    int num_results = 0;
-    int num;
-    char *token;
-    token = strtok(str, delim);
-    while (token != NULL) {
-	if ((num=atoi(token)) <= 0) {
-	    fprintf(stderr, "Non-int %s.\n", token);
-	    exit(EXIT_FAILURE);
-	}
-        if (num_results >= max_results) {
-	    fprintf(stderr, "Parsing too many ints.\n");
-	    exit(EXIT_FAILURE);
+void
+write_report(mmanager_t *mm, job_t *job) {
+    writer_t *w = &job->output;
+    record_t *rec;
+    int i;
+
+    open_writer(w, job->out);
+    put_str(w, "Cmd#\tOffset\tValue\n", 18);
+    put_str(w, "====\t======\t=====\n", 18);
+    for (i=0; i<job->recs.n; i++) {
+	rec = &job->recs.recs[i];
+	if (rec->handle != ERROR) {
+	    put_int(w, rec->cmd);
+	    put_char(w, '\t');
+	    put_int(w, (int)((char*)mm_deref(mm, rec->handle)
+			     - mm_memory(mm)));
+	    put_char(w, '\t');
+	    if (rec->type == INPUT_CHARS) {
+		print_chars(w, (char*)mm_deref(mm, rec->handle));
+	    } else {
+		print_ints(w, (int*)mm_deref(mm, rec->handle), rec->len);
+	    }
 	}
-	results[num_results++] = num;
-	token = strtok(NULL, delim);
     }
-    return num_results;
+    flush_writer(w);
 }
 
 /****************************************************************/
 
-/* print an array of ints
+/* write_report() on a thread of its own, for run_commands(). only reads
+ * the manager, which nothing changes any more.
  */
-void
-print_ints(int *intArray, size_t size) {
-    int i;
-    assert(size > 0);
-    printf("ints: %d", intArray[0]);
-    for (i=1; i<size; i++) {
-	printf(", %d", intArray[i]);
-    }
-    putchar('\n');
+void *
+report_thread(void *arg) {
+    job_t *job = arg;
+    write_report(job->mm, job);
+    return NULL;
 }
 
 /****************************************************************/
 
-/* print an array of chars
+/* call core_dump, or sparse_dump, for this thread's manager and job's
+ * commands, naming the files after prefix
  */
 void
-print_chars(char *charArray) {
-    printf("chars: %s\n", charArray);
+dump_memory(settings_t *set, job_t *job, char *prefix) {
+    char name[PATH_MAX], vars[PATH_MAX], cmds[PATH_MAX];
+    if (set->sparse) {
+	sparse_dump(dump_name(name, prefix, "core_sparse"), set->compress,
+		    &job->recs, job->commands);
+    } else {
+	core_dump(dump_name(name, prefix, "core_mem"),
+		  dump_name(vars, prefix, "core_vars"),
+		  dump_name(cmds, prefix, "core_cmds"), &job->recs,
+		  job->commands);
+    }
 }
 
 /****************************************************************/
 
-/* prints what is stored in memory given an array specifying
- * how previously allocated variables should be interpreted
- * (as int or char arrays)
+/* run job's commands in two stages: a parser thread reads lines and
+ * parses the ints of d commands, and this thread allocates, taking the
+ * commands in order from a ring the parser fills. anything the parser
+ * cannot make sense of is passed on as it is, so that errors come out
+ * just as they would one command at a time.
  */
 void
-print_memory(char isInt[MAXVARS]) {
-    void *start;
-    int i, num_bytes;
-    for (i=0; i<MAXVARS && manager.var_sizes[i]>0; i++) {
-	num_bytes = manager.var_sizes[i];
-	start = manager.vars[i];
-	if (isInt[i]) {
-	    print_ints((int*)start, num_bytes/sizeof(i));
+run_pipelined(settings_t *set, job_t *job) {
+    pipe_t *p;
+    pipe_cmd_t *c;
+    pthread_t parser;
+    int head;
+
+    if (posix_memalign((void **)&p, 64, sizeof(*p)) != 0) {
+	fprintf(stderr, "Out of memory.\n");
+	exit(EXIT_FAILURE);
+    }
+    p->head = p->tail = 0;
+    p->input = &job->input;
+    p->streaming = set->streaming;
+    p->lines = MAXLINES - job->commands;
+    pthread_create(&parser, NULL, parse_thread, p);
+
+    for (head = 0; ; head++) {
+	while (__atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == head) {
+	    sched_yield();
+	}
+	c = &p->slots[head % PIPE_SLOTS];
+	if (c->len == ERROR) {
+	    break;
+	}
+	if (c->oversize > 0) {
+	    fprintf(stderr, "Warning! %d over limit. Line truncated.\n",
+		    c->oversize);
+	}
+	if (c->numInts != ERROR) {
+	    store_ints(c->u.ints, c->numInts, c->intsLen, &job->recs,
+		       job->commands);
+	    end_command(job);
 	} else {
-	    print_chars((char*)start);
+	    run_command(c->u.line, c->len, job);
 	}
+	__atomic_store_n(&p->head, head+1, __ATOMIC_RELEASE);
     }
+    pthread_join(parser, NULL);
+    free(p);
 }
 
 /****************************************************************/
 
-/* perform the similar task to what malloc funtion does.
- * allocate a requested memory using several functions and return the address.
- * if it fails, returns manager.null 
+/* the parser thread of run_pipelined(): fill the ring with commands, and
+ * after the last one, a command of ERROR length.
  */
 void *
-mm_malloc(size_t size) {
-    int idx;
-    void* start = select_address(size);
-	
-    if (start == manager.null){
-	return manager.null;
+parse_thread(void *arg) {
+    pipe_t *p = arg;
+    pipe_cmd_t *c;
+    char *line, *token;
+    int tail = 0, len, tokenLen;
+
+    do {
+	while (tail - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE)
+	       == PIPE_SLOTS) {
+	    sched_yield();
+	}
+	c = &p->slots[tail % PIPE_SLOTS];
+	c->oversize = 0;
+	line = p->streaming || tail < p->lines
+	    ? next_line(p->input, LINELEN, &len, &c->oversize) : NULL;
+	c->len = line ? len : ERROR;
+	c->numInts = ERROR;
+	if (line && len >= 2 && line[0] == INPUT_INTS) {
+	    c->numInts = scan_integers(line+1, len-1, c->u.ints, &c->intsLen,
+				       &token, &tokenLen);
+	    c->numInts = c->numInts < 0 ? ERROR : c->numInts;
+	}
+	if (line && c->numInts == ERROR) {
+	    memcpy(c->u.line, line, len);
+	}
+	__atomic_store_n(&p->tail, ++tail, __ATOMIC_RELEASE);
+    } while (line);
+    return NULL;
+}
+
+/****************************************************************/
+
+/* whether r holds a trace written by compile_trace(), which only a file
+ * given whole can.
+ */
+int
+is_compiled(reader_t *r) {
+    return r->mapped && r->len >= COMPILED_HEADER
+	&& memcmp(r->buf, COMPILED_MAGIC, 8) == 0;
+}
+
+/****************************************************************/
+
+/* run the commands of job's input, a trace compiled by compile_trace(),
+ * straight from the mapped file: payloads are copied into memory as they
+ * are, and nothing is parsed unless a line was kept as text.
+ */
+void
+run_compiled(settings_t *set, job_t *job) {
+    unsigned char *p = (unsigned char *)job->input.buf;
+    unsigned char *end = p + job->input.len;
+    size_t len = 0;
+
+    if (get_le(p+8, 4) < 1 || get_le(p+8, 4) > COMPILED_VERSION) {
+	fprintf(stderr, "Compiled trace of version %d.\n",
+		(int)get_le(p+8, 4));
+	give_up();
     }
-	
-    idx = select_var();
-	
-    if(idx == ERROR){
-	return manager.null;
+    for (p += COMPILED_HEADER; (set->streaming || job->commands<MAXLINES)
+	     && p < end; p += COMPILED_OP + len) {
+	if (end-p < COMPILED_OP
+	    || (len = get_le(p+1, 4)) > (size_t)(end-p-COMPILED_OP)
+	    || len > COMPILED_MAXLEN) {
+	    fprintf(stderr, "Compiled command %d is cut short.\n",
+		    job->commands+1);
+	    give_up();
+	}
+	if (p[0] == COMPILED_WARNING && len == 4) {
+	    fprintf(stderr, "Warning! %d over limit. Line truncated.\n",
+		    (int)get_le(p+COMPILED_OP, 4));
+	} else {
+	    run_compiled_command(p[0], p+COMPILED_OP, len, job);
+	}
     }
-    
-    /* all conditions satisfied. allocate memory. */	
-    manager.var_sizes[idx] = size;
-    manager.vars[idx] = start;
-    return start;
 }
 
 /****************************************************************/
 
-/* check if the address ptr has been allocated as the start of an allocated 
- * block and free it by updating manager.vars and manager.var_sizes.
+/* run a command of a compiled trace, the next of job's, with len bytes of
+ * payload at data, see compile_trace().
  */
-void 
-mm_free(void *ptr){
-    int i;
-    for(i = 0; i<MAXVARS; i++){
-	if(ptr == manager.vars[i]){
-	    manager.vars[i] = manager.null;
-	    manager.var_sizes[i] = 0;
-	    return;
+void
+run_compiled_command(char op, unsigned char *data, int len, job_t *job) {
+    int ints[LINELEN/2+1];
+    record_t *rec = NULL;
+
+    if (op == COMPILED_LINE) {
+	run_command((char *)data, len, job);
+	return;
+    }
+
+    /* f and r start with the number of the command they are about */
+    if ((op == FREE_DATA || op == RESIZE_DATA) && len >= 4) {
+	if (!(rec = find_record(&job->recs, (int)get_le(data, 4) - 1))) {
+	    fprintf(stderr, "The command was alreadly freed.\n");
+	    give_up();
 	}
+	data += 4;
+	len -= 4;
     }
+
+    if (op == INPUT_CHARS) {
+	store_chars((char *)data, len, &job->recs, job->commands);
+    } else if (op == INPUT_INTS && compiled_ints(data, len)) {
+	store_ints(native_ints(data+4, len/4-1, ints), len/4-1,
+		   get_le(data, 4), &job->recs, job->commands);
+    } else if (op == FREE_DATA && rec && len == 0) {
+	free_record(&job->recs, rec);
+    } else if (op == RESIZE_DATA && rec && rec->type == INPUT_CHARS) {
+	append_chars(rec, (char *)data, len);
+    } else if (op == RESIZE_DATA && rec && compiled_ints(data, len)) {
+	append_ints(rec, native_ints(data+4, len/4-1, ints), len/4-1,
+		    get_le(data, 4));
+    } else if (op == COMPACT_DATA && len == 0) {
+	mm_compact(manager);
+    } else {
+	fprintf(stderr, "Compiled command %d is damaged.\n",
+		job->commands+1);
+	give_up();
+    }
+    end_command(job);
 }
 
 /****************************************************************/
 
-/* get two pointer arguments, which indicate the first and the last address 
- * respectively, and check if the memory between the addresses are valid.
+/* whether the len bytes at data are the ints of a compiled command: the
+ * number of items in the list, then no more ints than that, and no more
+ * than a line of d can hold, which is what native_ints() has room for.
  */
 int
-is_vacant(void *first, void *last){
-    int i;
-    char* first_ch = first;
-    char* last_ch = last;	
-    
-    /* check validity one by one */
-    while(last_ch-first_ch > -1){
-    	for(i = 0;i<MAXVARS; i++){
-       	    if(manager.var_sizes[i] > 0 && manager.vars[i] != manager.null){
-       	    	if ((char *)manager.vars[i] <= last_ch && last_ch
-		    < ((char *)manager.vars[i] + manager.var_sizes[i])){
-		    return 0;
-		}
-	    }
-	}
-	last_ch-=1;
+compiled_ints(unsigned char *data, int len) {
+    int n = len/4-1;
+    return len >= 4 && len % 4 == 0 && n <= LINELEN/2+1
+	&& get_le(data, 4) >= (uint64_t)n && get_le(data, 4) <= LINELEN;
+}
+
+/****************************************************************/
+
+/* the n little-endian ints at p as this machine has them: p itself, or
+ * where ints are big-endian, buf once they have been turned round into it.
+ * buf has room for the most ints a line of d holds.
+ */
+const void *
+native_ints(unsigned char *p, int n, int *buf) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    int k;
+    for (k=0; k<n; k++) {
+	buf[k] = get_le(p + 4*k, 4);
     }
-    return 1;
+    return buf;
+#else
+    (void)n;
+    (void)buf;
+    return p;
+#endif
 }
 
 /****************************************************************/
 
-/* select the earliest available address which can accommodate the passed size.
+/* compile the text commands read from r into a trace that run_compiled()
+ * can run without parsing, written to fd. after a header come the
+ * commands, each an opcode and the length of its payload, in 4 bytes:
+ * for c the chars, for d the number of items and then the ints, for f
+ * the command number, for r the command number and then the chars or
+ * the items and the ints it adds, and for k nothing. all numbers are
+ * little-endian. a line that would fail is kept as text, so that it
+ * fails just as it would have, and one that was cut short is preceded
+ * by the chars it lost, so that it warns just as it would have.
  */
-void *
-select_address(size_t size){
-    int i;
-    for(i = 1; i<= TOTALMEM-size ; i++){
-	if(is_vacant(manager.memory+i, manager.memory+(i+size-1))){
-	    return manager.memory+i;
+void
+compile_trace(reader_t *r, int fd) {
+    unsigned char payload[COMPILED_MAXLEN], head[COMPILED_HEADER];
+    writer_t w;
+    char *types = NULL, *line;
+    int n = 0, len, size, oversize;
+
+    open_writer(&w, fd);
+    memcpy(head, COMPILED_MAGIC, 8);
+    put_le(head+8, COMPILED_VERSION, 4);
+    put_str(&w, (char *)head, COMPILED_HEADER);
+    while ((line = next_line(r, LINELEN, &len, &oversize))) {
+	if (oversize > 0) {
+	    put_char(&w, COMPILED_WARNING);
+	    put_le(head, 4, 4);
+	    put_le(head+4, oversize, 4);
+	    put_str(&w, (char *)head, 8);
 	}
+	if (n == INT_MAX) {
+	    fprintf(stderr, "Too many commands.\n");
+	    exit(EXIT_FAILURE);
+	}
+	if (n % 4096 == 0) {
+	    types = grow_array(types, n, n+4096, 1);
+	}
+	types[n] = compile_command(line, len, types, n, payload, &size);
+	put_char(&w, types[n++]);
+	put_le(head, size, 4);
+	put_str(&w, (char *)head, 4);
+	put_str(&w, (char *)payload, size);
     }
-    return manager.null;
+    flush_writer(&w);
+    free(w.buf);
+    free(types);
 }
 
 /****************************************************************/
 
-/* select the earliest available index into manager.vars which is not assigned.
+/* compile the len chars of line, command n, into payload, with its length
+ * in *size, and return its opcode, see compile_trace(). types holds the
+ * opcodes of the commands before it.
  */
-int 
-select_var(void){
-    int i;
-    for(i = 0; i<MAXVARS ;i++){
-	if(manager.var_sizes[i]<=0 || manager.vars[i] == manager.null){
-	    return i;
+char
+compile_command(char *line, int len, char *types, int n,
+		unsigned char *payload, int *size) {
+    char *comma = memchr(line, INT_DELIM_C, len);
+    int target;
+
+    *size = 0;
+    if (len == 1 && line[0] == COMPACT_DATA) {
+	return COMPACT_DATA;
+    }
+    if (len >= 2 && line[0] == INPUT_CHARS) {
+	memcpy(payload, line+1, len-1);
+	*size = len-1;
+	return INPUT_CHARS;
+    }
+    if (len >= 2 && line[0] == INPUT_INTS
+	&& (*size = compile_ints(line+1, len-1, payload)) != ERROR) {
+	return INPUT_INTS;
+    }
+    if (len >= 2 && line[0] == FREE_DATA
+	&& (target = compiled_target(line+1, len-1, n)) != ERROR) {
+	put_le(payload, target, 4);
+	*size = 4;
+	return FREE_DATA;
+    }
+
+    /* what r adds is compiled as the command it adds to stored it */
+    if (len >= 2 && line[0] == RESIZE_DATA && comma
+	&& (target = compiled_target(line+1, comma-line-1, n)) != ERROR) {
+	put_le(payload, target, 4);
+	if (types[target-1] == INPUT_CHARS) {
+	    memcpy(payload+4, comma+1, line+len - (comma+1));
+	    *size = 4 + line+len - (comma+1);
+	    return RESIZE_DATA;
+	}
+	if (types[target-1] == INPUT_INTS
+	    && (*size = compile_ints(comma+1, line+len - (comma+1),
+				     payload+4)) != ERROR) {
+	    *size += 4;
+	    return RESIZE_DATA;
 	}
     }
-    return ERROR;
+    memcpy(payload, line, len);
+    *size = len;
+    return COMPILED_LINE;
 }
 
 /****************************************************************/
 
-/* at the end of the main function, all the resources stored in manger.memory
- * is written to disk to the binary file with name filename_mem.
- * some useful information on the stored resources are written to the
- * text file named filename_vars (an integer 
- * offset, an integer correspoinding to the size in manager.var_sizes).
+/* parse the list of ints in the len chars of str into payload, the number
+ * of items followed by the ints. returns the bytes of payload used, or
+ * ERROR if the list would not parse.
  */
-void core_dump(char *filename_mem, char* filename_vars){
-	
-    /* open two filestreams with "w" */	
-    FILE* mem_fptr = fopen(filename_mem, "w"); 
-    FILE* vars_fptr = fopen(filename_vars, "w");
-    int i;
+int
+compile_ints(char *str, int len, unsigned char *payload) {
+    int ints[LINELEN/2+1];
+    int k, intsLen, tokenLen, numInts;
+    char *token;
 
-    fwrite(manager.memory, sizeof(*(manager.memory)), TOTALMEM, mem_fptr);
-	
-    for(i = 0; i<MAXVARS; i++){
-	if(manager.var_sizes[i] > 0 && manager.vars != manager.null){
-	    fprintf(vars_fptr,"%d\t",
-	    	    (int)((char*)manager.vars[i]-manager.memory));
-	    fprintf(vars_fptr,"%d\n", (int)manager.var_sizes[i]);
+    numInts = scan_integers(str, len, ints, &intsLen, &token, &tokenLen);
+    if (numInts < 0) {
+	return ERROR;
+    }
+    put_le(payload, intsLen, 4);
+    for (k=0; k<numInts; k++) {
+	put_le(payload + 4 + 4*k, ints[k], 4);
+    }
+    return 4 + 4*numInts;
+}
+
+/****************************************************************/
+
+/* the command number in the len chars of s, if it names one of the n
+ * commands before it as parse_free() would have it, otherwise ERROR.
+ */
+int
+compiled_target(char *s, int len, int n) {
+    int i, num;
+    if (len < 1 || len > 9) {
+	return ERROR;
+    }
+    for (i=0; i<len; i++) {
+	if (s[i] < '0' || s[i] > '9') {
+	    return ERROR;
 	}
     }
-    fclose(mem_fptr);
-    fclose(vars_fptr);
+    parse_int(s, len, &num);
+    return num > 0 && num <= n ? num : ERROR;
+}
+
+/****************************************************************/
+
+/* give back what running job took: its buffers, its records and this
+ * thread's manager. descriptors are left to whoever opened them.
+ */
+void
+free_job(job_t *job) {
+    if (job->input.mapped) {
+	munmap(job->input.buf, job->input.cap);
+    } else {
+	free(job->input.buf);
+    }
+    free(job->output.buf);
+    free(job->recs.recs);
+    memset(&job->input, 0, sizeof(job->input));
+    memset(&job->output, 0, sizeof(job->output));
+    memset(&job->recs, 0, sizeof(job->recs));
+    if (job->log) {
+	fclose(job->log);
+	job->log = NULL;
+    }
+    if (manager) {
+	mm_destroy(manager);
+	manager = NULL;
+    }
+}
+
+/****************************************************************/
+
+/* stop running commands after an error has been reported. on its own that
+ * ends the program, but in a batch only the current file fails, see
+ * run_job().
+ */
+void
+give_up(void) {
+    if (job_exit) {
+	longjmp(*job_exit, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/****************************************************************/
+
+/* mm_new_array(), giving up if we are out of memory.
+ */
+void *
+new_array(size_t n, size_t size) {
+    void *array = mm_new_array(n, size);
+    if (!array) {
+	fprintf(stderr, "Out of memory.\n");
+	give_up();
+    }
+    return array;
+}
+
+/****************************************************************/
+
+/* mm_grow_array(), giving up if we are out of memory.
+ */
+void *
+grow_array(void *array, size_t n, size_t more, size_t size) {
+    array = mm_grow_array(array, n, more, size);
+    if (!array) {
+	fprintf(stderr, "Out of memory.\n");
+	give_up();
+    }
+    return array;
+}
+
+/****************************************************************/
+
+/* run every one of n files on threads threads, each with a manager of its
+ * own. a file's report goes to file.out and its dump to file.core_mem,
+ * file.core_vars and file.core_cmds, or file.core_sparse. files are
+ * dealt out to the threads in runs, and a thread that finishes its own
+ * steals from the others. prints how long the batch took, and returns
+ * EXIT_FAILURE if any file failed.
+ */
+int
+run_batch(settings_t *set, char **files, int n, int threads) {
+    batch_t batch;
+    pthread_t tids[BATCH_MAXTHREADS];
+    struct timespec t0, t1;
+    double secs;
+    int i, failed = 0;
+
+    /* every thread already has a file of its own to keep it busy */
+    set->pipelined = 0;
+    batch.set = set;
+    batch.nthreads = threads;
+    batch.jobs = new_array(n, sizeof(*batch.jobs));
+    for (i=0; i<n; i++) {
+	batch.jobs[i].name = files[i];
+    }
+    if (posix_memalign((void **)&batch.queues, 64,
+		       threads*sizeof(*batch.queues)) != 0) {
+	fprintf(stderr, "Out of memory.\n");
+	exit(EXIT_FAILURE);
+    }
+    for (i=0; i<threads; i++) {
+	pthread_mutex_init(&batch.queues[i].lock, NULL);
+	batch.queues[i].head = (long)n*i/threads;
+	batch.queues[i].tail = (long)n*(i+1)/threads;
+	batch.queues[i].batch = &batch;
+	batch.queues[i].id = i;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i=0; i<threads; i++) {
+	pthread_create(&tids[i], NULL, batch_worker, &batch.queues[i]);
+    }
+    for (i=0; i<threads; i++) {
+	pthread_join(tids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9;
+
+    for (i=0; i<n; i++) {
+	if (batch.jobs[i].failed) {
+	    fprintf(stderr, "%s: failed.\n", batch.jobs[i].name);
+	    failed++;
+	}
+    }
+    printf("files\tfailed\tthreads\tseconds\tfiles/sec\n");
+    printf("%d\t%d\t%d\t%.3f\t%.0f\n", n, failed, threads, secs, n/secs);
+
+    for (i=0; i<threads; i++) {
+	pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free(batch.queues);
+    free(batch.jobs);
+    return failed ? EXIT_FAILURE : 0;
+}
+
+/****************************************************************/
+
+/* one batch thread: run files until there are none left anywhere.
+ */
+void *
+batch_worker(void *arg) {
+    queue_t *queue = arg;
+    batch_t *batch = queue->batch;
+    int j;
+
+    while ((j = next_job(batch, queue->id)) != ERROR) {
+	run_job(batch->set, &batch->jobs[j]);
+    }
+    return NULL;
+}
+
+/****************************************************************/
+
+/* the next file for thread id of batch: the first of its own, or failing
+ * that the last of another thread's. returns ERROR once all are taken.
+ */
+int
+next_job(batch_t *batch, int id) {
+    queue_t *q;
+    int i, j = ERROR;
+
+    for (i=0; i<batch->nthreads && j == ERROR; i++) {
+	q = &batch->queues[(id+i) % batch->nthreads];
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail) {
+	    j = i == 0 ? q->head++ : --q->tail;
+	}
+	pthread_mutex_unlock(&q->lock);
+    }
+    return j;
+}
+
+/****************************************************************/
+
+/* run the commands of one file of a batch, marking it failed rather than
+ * ending the program if any of them are bad.
+ */
+void
+run_job(settings_t *set, job_t *job) {
+    char prefix[PATH_MAX], name[PATH_MAX];
+    jmp_buf env;
+
+    job->in = job->out = ERROR;
+    job_exit = &env;
+    if (setjmp(env) == 0) {
+	dump_name(prefix, job->name, ".");
+	if ((job->in = open(job->name, O_RDONLY)) < 0
+	    || (job->out = open(dump_name(name, prefix, "out"),
+				O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+	    perror(job->in < 0 ? job->name : name);
+	    give_up();
+	}
+	run_commands(set, job, prefix);
+    } else {
+	job->failed = 1;
+    }
+    job_exit = NULL;
+    free_job(job);
+    if (job->in >= 0) {
+	close(job->in);
+    }
+    if (job->out >= 0) {
+	close(job->out);
+    }
+}
+
+/****************************************************************/
+
+/* get ready to read lines from fd. a regular file is mapped into memory
+ * as a whole; anything else is read a large block at a time.
+ */
+void
+open_reader(reader_t *r, int fd){
+    struct stat st;
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	r->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r->buf != MAP_FAILED) {
+	    madvise(r->buf, st.st_size, MADV_SEQUENTIAL);
+	    r->len = r->cap = st.st_size;
+	    r->mapped = r->eof = 1;
+	    return;
+	}
+    }
+    r->cap = READBUF;
+    r->buf = new_array(r->cap, 1);
+}
+
+/****************************************************************/
+
+/* read more input into the end of the buffer, noting when there is none.
+ */
+void
+fill_reader(reader_t *r){
+    ssize_t got = read(r->fd, r->buf + r->len, r->cap - r->len);
+    if (got <= 0) {
+	r->eof = 1;
+    } else {
+	r->len += got;
+    }
+}
+
+/****************************************************************/
+
+/* read in a line of input
+ * the line is returned in place, without its newline and not terminated,
+ * with its length in *len; it stays valid until the next call. lines
+ * longer than maxlen are cut short with a warning. returns NULL at the
+ * end of the input.
+ */
+char *
+read_line(reader_t *r, int maxlen, int *len) {
+    int oversize;
+    char *line = next_line(r, maxlen, len, &oversize);
+    if (oversize > 0) {
+	fprintf(stderr, "Warning! %d over limit. Line truncated.\n",
+		oversize);
+    }
+    return line;
+}
+
+/****************************************************************/
+
+/* like read_line(), but rather than warn about a line cut short, set
+ * *oversize to the number of bytes it lost.
+ */
+char *
+next_line(reader_t *r, int maxlen, int *len, int *oversize) {
+    char *line, *nl;
+
+    *oversize = 0;
+
+    while ((nl = memchr(r->buf + r->pos, '\n', r->len - r->pos)) == NULL) {
+	if (r->eof) {
+	    if (r->pos == r->len) {
+		return NULL;
+	    }
+	    nl = r->buf + r->len;
+	    break;
+	}
+	/* keep the start of the line at the front and read on behind it */
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+	if (r->len > (size_t)maxlen) {
+	    /* only the first maxlen bytes are kept, count the rest */
+	    *oversize += r->len - maxlen;
+	    r->len = maxlen;
+	}
+	fill_reader(r);
+    }
+
+    line = r->buf + r->pos;
+    *len = nl - line;
+    r->pos = nl - r->buf + (nl < r->buf + r->len);
+    if (*len > maxlen) {
+	*oversize += *len - maxlen;
+	*len = maxlen;
+    }
+    return line;
+}
+
+/****************************************************************/
+
+/* process an input-char command from stdin by storing the string
+ */
+void
+process_input_char(char *line, int len, records_t *recs, int numCommands) {
+    store_chars(line+1, len-1, recs, numCommands);
+}
+
+/****************************************************************/
+
+/* store the len chars of an input-char command as a string
+ */
+void
+store_chars(char *chars, int len, records_t *recs, int numCommands) {
+    size_t size = len+1;
+    char *start;
+    int h = mm_halloc(manager, size);
+    assert(h != ERROR);
+    start = mm_deref(manager, h);
+    memcpy(start, chars, len);
+    start[len] = '\0';
+    mm_touch(manager, start, size);
+    add_record(recs, numCommands, INPUT_CHARS, h, size);
+}
+
+/****************************************************************/
+
+/* process an input-int command from stdin by storing the ints
+ */
+void
+process_input_int(char *line, int len, records_t *recs, int numCommands) {
+    int ints[LINELEN/2+1];
+    int intsLen, numInts = parse_integers(line+1, len-1, ints, &intsLen);
+    store_ints(ints, numInts, intsLen, recs, numCommands);
+}
+
+/****************************************************************/
+
+/* store the numInts ints of an input-int command that had intsLen items,
+ * once they have been parsed. ints need not be aligned.
+ */
+void
+store_ints(const void *ints, int numInts, int intsLen, records_t *recs,
+	   int numCommands) {
+    size_t size = sizeof(intsLen) * intsLen;
+    int h = mm_halloc_aligned(manager, size, int_align);
+    assert(h != ERROR);
+    memcpy(mm_deref(manager, h), ints, sizeof(int) * numInts);
+    mm_touch(manager, mm_deref(manager, h), sizeof(int) * numInts);
+    add_record(recs, numCommands, INPUT_INTS, h, intsLen);
+}
+
+/****************************************************************/
+
+/* process a free command from stdin
+ */
+void
+process_free(char *line, int len, records_t *recs, int numCommands) {
+
+    record_t *rec;
+    /* check if it is a valid command */
+    rec = parse_free(line+1, len-1, recs, numCommands);
+    free_record(recs, rec);
+}
+
+/****************************************************************/
+
+/* free the variable of rec and forget it
+ */
+void
+free_record(records_t *recs, record_t *rec) {
+    /* call mm_hfree to free the allocated memory */
+    if (mm_hfree(manager, rec->handle) == ERROR) {
+	fprintf(stderr, "Command %d was never allocated.\n", rec->cmd+1);
+	give_up();
+    }
+    drop_record(recs, rec);
+}
+
+/****************************************************************/
+
+/* process a resize command, r<cmd#>,<values>, by appending the values to
+ * what an earlier c or d command stored, through mm_hrealloc.
+ */
+void
+process_resize(char *line, int len, records_t *recs, int numCommands) {
+    int ints[LINELEN/2+1];
+    char *comma = memchr(line, INT_DELIM_C, len);
+    int intsLen, numInts, more;
+    record_t *rec;
+    char *values;
+
+    if (!comma) {
+	fprintf(stderr, "Invalid line %.*s\n", len, line);
+	give_up();
+    }
+    rec = parse_free(line+1, comma-line-1, recs, numCommands);
+    values = comma+1;
+    more = line+len - values;
+
+    if (rec->type == INPUT_CHARS) {
+	append_chars(rec, values, more);
+    } else {
+	numInts = parse_integers(values, more, ints, &intsLen);
+	append_ints(rec, ints, numInts, intsLen);
+    }
+}
+
+/****************************************************************/
+
+/* append more chars to the string of rec, through mm_hrealloc. the old
+ * bytes stay where they were, or are moved as they are.
+ */
+void
+append_chars(record_t *rec, char *chars, int more) {
+    int done = mm_hrealloc(manager, rec->handle, rec->len+more);
+    assert(done != ERROR);
+    memcpy((char *)mm_deref(manager, rec->handle) + rec->len-1, chars, more);
+    rec->len += more;
+    ((char *)mm_deref(manager, rec->handle))[rec->len-1] = '\0';
+    mm_touch(manager, (char *)mm_deref(manager, rec->handle) + rec->len-1
+	     - more, more+1);
+}
+
+/****************************************************************/
+
+/* like append_chars(), but append the numInts ints of a list of intsLen
+ * items to the ints of rec. ints need not be aligned.
+ */
+void
+append_ints(record_t *rec, const void *ints, int numInts, int intsLen) {
+    int done = mm_hrealloc(manager, rec->handle,
+			   sizeof(int) * (rec->len+intsLen));
+    assert(done != ERROR);
+    memcpy((int *)mm_deref(manager, rec->handle) + rec->len, ints,
+	   sizeof(int) * numInts);
+    mm_touch(manager, (int *)mm_deref(manager, rec->handle) + rec->len,
+	     sizeof(int) * numInts);
+    rec->len += intsLen;
+}
+
+/****************************************************************/
+
+/* process a compact command, a lone k, by sliding every variable down to
+ * the start of memory. handles stay as they are.
+ */
+void
+process_compact(char *line, int len) {
+    if (len != 1) {
+	fprintf(stderr, "Invalid line %.*s\n", len, line);
+	give_up();
+    }
+    mm_compact(manager);
+}
+
+/****************************************************************/
+
+/* remember that command cmd stored len chars or ints of the given type
+ * under handle h. commands come in order, so appending keeps the records
+ * sorted by command number.
+ */
+void
+add_record(records_t *recs, int cmd, char type, int h, int len) {
+    record_t *rec;
+    if (recs->n == recs->cap) {
+	recs->cap = recs->cap ? 2*recs->cap : 64;
+	recs->recs = grow_array(recs->recs, recs->n, recs->cap,
+				   sizeof(*recs->recs));
+    }
+    rec = &recs->recs[recs->n++];
+    rec->cmd = cmd;
+    rec->type = type;
+    rec->handle = h;
+    rec->len = len;
+}
+
+/****************************************************************/
+
+/* the record of the variable command cmd stored, found by binary search,
+ * or NULL if that command stored nothing or it has since been freed.
+ */
+record_t *
+find_record(records_t *recs, int cmd) {
+    int lo = 0, hi = recs->n, mid;
+    while (lo < hi) {
+	mid = lo + (hi-lo)/2;
+	if (recs->recs[mid].cmd < cmd) {
+	    lo = mid+1;
+	} else {
+	    hi = mid;
+	}
+    }
+    if (lo == recs->n || recs->recs[lo].cmd != cmd
+	|| recs->recs[lo].handle == ERROR) {
+	return NULL;
+    }
+    return &recs->recs[lo];
+}
+
+/****************************************************************/
+
+/* forget a freed variable. its record stays, marked, until freed ones
+ * outnumber live ones, when they are all squeezed out at once, so that
+ * the records take space in proportion to the live variables rather than
+ * to the number of commands.
+ */
+void
+drop_record(records_t *recs, record_t *rec) {
+    int i, n = 0;
+    rec->handle = ERROR;
+    if (++recs->dead <= recs->n/2) {
+	return;
+    }
+    for (i=0; i<recs->n; i++) {
+	if (recs->recs[i].handle != ERROR) {
+	    recs->recs[n++] = recs->recs[i];
+	}
+    }
+    recs->n = n;
+    recs->dead = 0;
+}
+
+/****************************************************************/
+
+/* the record of each live variable of recs by its handle, in an array of
+ * maxvars that the caller frees; NULL where there is none.
+ */
+record_t **
+records_by_handle(records_t *recs, int maxvars) {
+    record_t **byHandle = new_array(maxvars, sizeof(*byHandle));
+    int i;
+    for (i=0; i<recs->n; i++) {
+	if (recs->recs[i].handle != ERROR) {
+	    byHandle[recs->recs[i].handle] = &recs->recs[i];
+	}
+    }
+    return byHandle;
+}
+
+/****************************************************************/
+
+/* order records by command number, for qsort().
+ */
+int
+compare_records(const void *a, const void *b) {
+    const record_t *x = a, *y = b;
+    return x->cmd < y->cmd ? -1 : x->cmd > y->cmd;
+}
+
+/****************************************************************/
+
+/* convert the first len chars of s like atoi does, into *num: leading
+ * white space, an optional sign, then as many digits as there are.
+ * Returns SUCCESS, or INT_TOO_LARGE if the digits don't fit in an int.
+ */
+int
+parse_int(char *s, int len, int *num) {
+    char *end = s + len;
+    int sign = 1, overflow = 0;
+    uint64_t n = 0;
+    while (s < end && isspace((unsigned char)*s)) {
+	s++;
+    }
+    if (s < end && (*s == '-' || *s == '+')) {
+	sign = *(s++) == '-' ? -1 : 1;
+    }
+    while (s < end && isdigit((unsigned char)*s)) {
+	n = n*10 + (*(s++) - '0');
+	overflow |= n > INT_MAX;
+	n = overflow ? 0 : n;
+    }
+    if (overflow) {
+	return INT_TOO_LARGE;
+    }
+    *num = sign*(int)n;
+    return SUCCESS;
+}
+
+/****************************************************************/
+
+/* check if the number that 'f' command is followed by is valid or not.
+ * If not valid, an error message appears on screen and the program exits. 
+ */
+record_t *
+parse_free(char* line, int len, records_t *recs, int numCommands){
+    record_t *rec;
+    int i, f_num;
+    
+    if(parse_int(line, len, &f_num) == INT_TOO_LARGE){
+        fprintf(stderr, "Int too large %.*s.\n", len, line);
+        give_up();
+    }
+    
+    if(f_num <= 0){
+        fprintf(stderr, "Not available.\n");
+        give_up();
+    }
+    
+    if(f_num > numCommands){
+    	fprintf(stderr, "The number should be less or equal than %d.\n"
+    		, numCommands);
+    	give_up();
+    }
+    
+    if((rec = find_record(recs, f_num-1)) == NULL){
+    	fprintf(stderr, "The command was alreadly freed.\n");
+    	give_up();
+    }
+    
+    for(i = 0; i<len; i++){
+        if('0'>line[i] || '9'<line[i]){
+            fprintf(stderr,
+            	    "Neither spaces nor chars other than numbers allowed.\n");
+            give_up();
+        }
+    }
+    return rec;
+}
+
+/****************************************************************/
+
+/* parse the first len chars of str, a delimited-list of positive integers,
+ * into results, see scan_integers(). Returns number of ints parsed. If an
+ * item is not a positive int, or is too large for one, execution will halt.
+ */
+int
+parse_integers(char *str, int len, int results[], int *slots) {
+    char *token;
+    int tokenLen, n = scan_integers(str, len, results, slots, &token,
+				    &tokenLen);
+    if (n == NOT_INT) {
+	fprintf(stderr, "Non-int %.*s.\n", tokenLen, token);
+	give_up();
+    }
+    if (n == INT_TOO_LARGE) {
+	fprintf(stderr, "Int too large %.*s.\n", tokenLen, token);
+	give_up();
+    }
+    return n;
+}
+
+/****************************************************************/
+
+/* parse the first len chars of str, a delimited-list of positive integers,
+ * into results in a single pass. *slots is set to the number of items in
+ * the list, including empty ones, which are skipped. Each item is read
+ * like atoi does. Returns number of ints parsed, or NOT_INT or
+ * INT_TOO_LARGE with the item at fault in *token and *tokenLen.
+ */
+int
+scan_integers(char *str, int len, int results[], int *slots, char **token,
+	      int *tokenLen) {
+    char *end = str + len;
+    int num_results = 0, negative, overflow;
+    uint64_t num, chunk;
+
+    *slots = 1;
+    for (; str < end; str++) {
+	if (*str == INT_DELIM_C) {
+	    (*slots)++;
+	    continue;
+	}
+	*token = str;
+	while (str < end && isspace((unsigned char)*str)) {
+	    str++;
+	}
+	negative = str < end && *str == '-';
+	if (str < end && (*str == '-' || *str == '+')) {
+	    str++;
+	}
+
+	/* eight digits at a time while there are that many, then one by one */
+	num = 0;
+	overflow = 0;
+	while (end-str >= 8 && (chunk = digits8(str)) != ERROR_DIGITS) {
+	    num = num*100000000 + chunk;
+	    overflow |= num > INT_MAX;
+	    num = overflow ? 0 : num;
+	    str += 8;
+	}
+	while (str < end && isdigit((unsigned char)*str)) {
+	    num = num*10 + (*(str++) - '0');
+	    overflow |= num > INT_MAX;
+	    num = overflow ? 0 : num;
+	}
+
+	/* like atoi, whatever follows the digits is ignored */
+	while (str < end && *str != INT_DELIM_C) {
+	    str++;
+	}
+	if (negative || (num == 0 && !overflow)) {
+	    *tokenLen = str - *token;
+	    return NOT_INT;
+	}
+	if (overflow) {
+	    *tokenLen = str - *token;
+	    return INT_TOO_LARGE;
+	}
+	results[num_results++] = num;
+	if (str < end) {
+	    (*slots)++;
+	}
+    }
+    return num_results;
+}
+
+/****************************************************************/
+
+/* the value of the eight chars at s if they are all digits, otherwise
+ * ERROR_DIGITS. All eight are checked and converted together inside one
+ * 64-bit word.
+ */
+uint64_t
+digits8(char *s) {
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    /* every byte is 0x30..0x39 exactly when its high nibble is 3 and
+     * adding 6 does not carry into the high nibble
+     */
+    if (((v & 0xF0F0F0F0F0F0F0F0ULL)
+	 | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+	!= 0x3333333333333333ULL) {
+	return ERROR_DIGITS;
+    }
+    /* combine neighbouring digits into pairs, then fours, then all eight */
+    v -= 0x3030303030303030ULL;
+    v = v*10 + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+	 + (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+	>> 32;
+    return v;
+}
+
+/****************************************************************/
+
+/* print an array of ints
+ */
+void
+print_ints(writer_t *w, int *intArray, size_t size) {
+    size_t i;
+    assert(size > 0);
+    put_str(w, "ints: ", 6);
+    put_int(w, intArray[0]);
+    for (i=1; i<size; i++) {
+	put_str(w, ", ", 2);
+	put_int(w, intArray[i]);
+    }
+    put_char(w, '\n');
+}
+
+/****************************************************************/
+
+/* print an array of chars
+ */
+void
+print_chars(writer_t *w, char *charArray) {
+    put_str(w, "chars: ", 7);
+    put_str(w, charArray, strlen(charArray));
+    put_char(w, '\n');
+}
+
+/****************************************************************/
+
+/* prints what is stored in memory given an array specifying
+ * how previously allocated variables should be interpreted
+ * (as int or char arrays)
+ */
+void
+print_memory(writer_t *w, char isInt[]) {
+    void *start;
+    int i, num_bytes;
+    for (i=0; i<mm_maxvars(manager)
+	     && (num_bytes = mm_var(manager, i, &start))>0; i++) {
+	if (isInt[i]) {
+	    print_ints(w, (int*)start, num_bytes/sizeof(i));
+	} else {
+	    print_chars(w, (char*)start);
+	}
+    }
+}
+
+/****************************************************************/
+
+/* get ready to write to fd through a buffer of WRITEBUF bytes.
+ */
+void
+open_writer(writer_t *w, int fd) {
+    w->fd = fd;
+    w->len = 0;
+    w->buf = new_array(WRITEBUF, 1);
+}
+
+/****************************************************************/
+
+/* write out everything in the buffer.
+ */
+void
+flush_writer(writer_t *w) {
+    size_t done = 0;
+    ssize_t n;
+    while (done < w->len) {
+	if ((n = write(w->fd, w->buf + done, w->len - done)) < 0) {
+	    perror("write");
+	    give_up();
+	}
+	done += n;
+    }
+    w->len = 0;
+}
+
+/****************************************************************/
+
+/* append len chars of s to the buffer.
+ */
+void
+put_str(writer_t *w, char *s, size_t len) {
+    size_t n;
+    while (len > 0) {
+	if (w->len == WRITEBUF) {
+	    flush_writer(w);
+	}
+	n = WRITEBUF - w->len < len ? WRITEBUF - w->len : len;
+	memcpy(w->buf + w->len, s, n);
+	w->len += n;
+	s += n;
+	len -= n;
+    }
+}
+
+/****************************************************************/
+
+/* append one char to the buffer.
+ */
+void
+put_char(writer_t *w, char c) {
+    if (w->len == WRITEBUF) {
+	flush_writer(w);
+    }
+    w->buf[w->len++] = c;
+}
+
+/****************************************************************/
+
+/* append num in decimal, as printf's %d would. Digits are produced two
+ * at a time from a table, from the right.
+ */
+void
+put_int(writer_t *w, int num) {
+    static const char pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233"
+	"34353637383940414243444546474849505152535455565758596061626364656667"
+	"6869707172737475767778798081828384858687888990919293949596979899";
+    char digits[12], *p = digits + sizeof(digits);
+    unsigned int u = num < 0 ? -(unsigned int)num : (unsigned int)num;
+
+    while (u >= 100) {
+	p -= 2;
+	memcpy(p, pairs + 2*(u % 100), 2);
+	u /= 100;
+    }
+    if (u >= 10) {
+	p -= 2;
+	memcpy(p, pairs + 2*u, 2);
+    } else {
+	*(--p) = '0' + u;
+    }
+    if (num < 0) {
+	*(--p) = '-';
+    }
+    if (w->len + sizeof(digits) > WRITEBUF) {
+	flush_writer(w);
+    }
+    memcpy(w->buf + w->len, p, digits + sizeof(digits) - p);
+    w->len += digits + sizeof(digits) - p;
+}
+
+/****************************************************************/
+
+/* read a size such as 4096, 64k or 1m, returning 0 if it is not one.
+ */
+size_t
+parse_size(char *s){
+    char *end;
+    size_t size = strtoul(s, &end, 10);
+    switch(tolower(*end)){
+    case 'g':
+	size <<= 10;
+	/* fall through */
+    case 'm':
+	size <<= 10;
+	/* fall through */
+    case 'k':
+	size <<= 10;
+	end++;
+    }
+    return *end == '\0' ? size : 0;
+}
+
+/****************************************************************/
+
+/* one benchmark thread: keep a window of live blocks, replacing a random
+ * one each step. every eighth block is swapped through mt_handoff instead,
+ * so that it is freed by whichever thread picks it up next.
+ */
+void *
+mt_bench_thread(void *arg){
+    long ops = *(long *)arg, i;
+    void *live[MT_WINDOW] = {NULL}, *old;
+    uint64_t rnd = (uint64_t)(uintptr_t)&ops | 1;
+    size_t size;
+    int k;
+
+    for(i = 0; i<ops; i++){
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+	k = rnd % MT_WINDOW;
+	if(live[k]){
+	    old = live[k];
+	    if((rnd>>8) % 8 == 0){
+		old = __atomic_exchange_n(&mt_handoff[(rnd>>16) % MT_WINDOW],
+					  old, __ATOMIC_SEQ_CST);
+	    }
+	    if(old){
+		mt_free(old);
+	    }
+	}
+	size = (rnd>>24) % 32 == 0 ? 1 + (rnd>>32) % 4096
+	    : 1 + (rnd>>32) % (MT_MINSIZE<<(MT_CLASSES-1));
+	if((live[k] = mt_malloc(size)) != NULL){
+	    *(char *)live[k] = (char)i;
+	}
+    }
+    for(k = 0; k<MT_WINDOW; k++){
+	if(live[k]){
+	    mt_free(live[k]);
+	}
+    }
+    mt_flush();
+    return NULL;
+}
+
+/****************************************************************/
+
+/* run ops malloc/free pairs on each of 1, 2, 4, 8 and 16 threads, one
+ * arena per thread, and print the overall rate for each.
+ */
+void
+mt_bench(long ops, int policy){
+    pthread_t threads[MT_MAXTHREADS];
+    struct timespec t0, t1;
+    double secs;
+    void *old;
+    int n, t, k;
+
+    printf("threads\tops\tseconds\tops/sec\n");
+    for(n = 1; n<=MT_MAXTHREADS; n *= 2){
+	if(mt_init(n, MT_ARENASIZE, MT_ARENAVARS, policy) == ERROR){
+	    fprintf(stderr, "Cannot set up %d arenas.\n", n);
+	    exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(t = 0; t<n; t++){
+	    pthread_create(&threads[t], NULL, mt_bench_thread, &ops);
+	}
+	for(t = 0; t<n; t++){
+	    pthread_join(threads[t], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for(k = 0; k<MT_WINDOW; k++){
+	    if((old = __atomic_exchange_n(&mt_handoff[k], NULL,
+					  __ATOMIC_SEQ_CST)) != NULL){
+		mt_free(old);
+	    }
+	}
+	mt_flush();
+	mt_destroy();
+
+	secs = (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9;
+	printf("%d\t%ld\t%.3f\t%.0f\n", n, 2*ops*n, secs, 2*ops*n/secs);
+    }
+}
+
+/****************************************************************/
+
+/* the next number of a xorshift generator, so that a trace depends only
+ * on its seed and not on the C library.
+ */
+uint64_t
+trace_rand(uint64_t *state){
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/****************************************************************/
+
+/* read a trace description such as "n=100000,sizes=bimodal,free=30" into
+ * ts, starting from the defaults. returns ERROR on an unknown key or an
+ * impossible value.
+ */
+int
+parse_trace_spec(char *spec, trace_spec_t *ts){
+    char *const keys[] = {"n", "seed", "min", "max", "sizes", "free",
+			  "life", "live", "pattern", NULL};
+    char *const sizes[] = {"uniform", "skewed", "bimodal", NULL};
+    char *const lives[] = {"random", "fifo", "lifo", NULL};
+    char *const patterns[] = {"none", "holes", "sawtooth", NULL};
+    char *const *names[] = {NULL, NULL, NULL, NULL, sizes, NULL,
+			    lives, NULL, patterns};
+    int *fields[] = {&ts->n, NULL, &ts->min, &ts->max, &ts->sizes,
+		     &ts->freepct, &ts->life, &ts->maxlive, &ts->pattern};
+    char *value, *dummy;
+    int key;
+
+    ts->n = 100000;
+    ts->seed = 1;
+    ts->min = 4;
+    ts->max = 256;
+    ts->sizes = TRACE_UNIFORM;
+    ts->freepct = 40;
+    ts->life = TRACE_RANDOM;
+    ts->maxlive = 1000;
+    ts->pattern = TRACE_NONE;
+
+    while(*spec != '\0'){
+	if((key = getsubopt(&spec, keys, &value)) < 0 || value == NULL){
+	    return ERROR;
+	}
+	if(fields[key] == NULL){
+	    ts->seed = strtoull(value, NULL, 10);
+	} else if(names[key] != NULL){
+	    dummy = value;
+	    if((*fields[key] = getsubopt(&dummy, names[key], &value)) < 0){
+		return ERROR;
+	    }
+	} else {
+	    *fields[key] = atoi(value);
+	}
+    }
+    /* every size must make a c or d command of one line */
+    if(ts->min < 4){
+	ts->min = 4;
+    }
+    if(ts->max > LINELEN-1){
+	ts->max = LINELEN-1;
+    }
+    if(ts->seed == 0){
+	ts->seed = 1;
+    }
+    return ts->n > 0 && ts->min <= ts->max && ts->freepct >= 0
+	&& (ts->pattern != TRACE_HOLES || ts->min < ts->max)
+	&& ts->freepct <= 100 && ts->maxlive > 0 ? SUCCESS : ERROR;
+}
+
+/****************************************************************/
+
+/* pick the size of the next allocation from the distribution of ts:
+ * uniform over min to max, skewed so that each halving of the range is
+ * twice as likely as the last, or bimodal with nine in ten near min and
+ * the rest near max.
+ */
+int
+trace_size(trace_spec_t *ts, uint64_t *state){
+    uint64_t r = trace_rand(state);
+    int range = ts->max - ts->min;
+
+    if(ts->sizes == TRACE_SKEWED){
+	range >>= __builtin_ctzll(r | (uint64_t)1<<32);
+	r >>= 32;
+    } else if(ts->sizes == TRACE_BIMODAL){
+	if(r % 10 == 0){
+	    return ts->max - (int)((r>>8) % (range/8 + 1));
+	}
+	range /= 8;
+	r >>= 8;
+    }
+    return ts->min + (int)(r % (range + 1));
+}
+
+/****************************************************************/
+
+/* generate the commands ts describes. live allocations are kept in a ring
+ * so that the oldest, the newest or a random one can be freed. the holes
+ * pattern first fills memory with alternately small and large blocks,
+ * frees all the small ones, and from then on only asks for blocks too
+ * big for the holes left; sawtooth fills up to maxlive and then empties
+ * again.
+ */
+trace_op_t *
+gen_trace(trace_spec_t *ts){
+    trace_op_t *ops = new_array(ts->n, sizeof(*ops));
+    int *ring = new_array(ts->maxlive, sizeof(*ring));
+    int head = 0, count = 0, i, k, filling = 1, filled = 0, punched = 0;
+    uint64_t state = ts->seed;
+
+    for(i = 0; i<ts->n; i++){
+	if(ts->pattern == TRACE_HOLES && !filled
+	   && (count == ts->maxlive || i >= ts->n/2)){
+	    /* only the large blocks, at odd commands, stay live */
+	    filled = i;
+	    for(k = 1, head = count = 0; k<filled; k += 2){
+		ring[count++] = k;
+	    }
+	}
+	if(punched < filled){
+	    ops[i].cmd = FREE_DATA;
+	    ops[i].target = punched;
+	    punched += 2;
+	    continue;
+	}
+
+	if(ts->pattern == TRACE_SAWTOOTH){
+	    filling = count == 0 || (filling && count < ts->maxlive);
+	} else if(ts->pattern == TRACE_HOLES && !filled){
+	    filling = 1;
+	} else {
+	    filling = count == 0 || (count < ts->maxlive
+		&& (int)(trace_rand(&state) % 100) >= ts->freepct);
+	}
+
+	if(filling){
+	    ops[i].cmd = trace_rand(&state) & 1 ? INPUT_CHARS : INPUT_INTS;
+	    if(ts->pattern != TRACE_HOLES){
+		ops[i].size = trace_size(ts, &state);
+	    } else if(!filled){
+		ops[i].size = i & 1 ? ts->max : ts->min;
+	    } else {
+		ops[i].size = ts->min+1
+		    + (int)(trace_rand(&state) % (ts->max - ts->min));
+	    }
+	    if(ops[i].cmd == INPUT_INTS){
+		ops[i].size = (ops[i].size + 3) & ~3;
+	    }
+	    ring[(head+count++) % ts->maxlive] = i;
+	    continue;
+	}
+
+	/* free one of the live allocations, as ts->life says. the holes
+	 * pattern frees the newest so the large blocks stay put
+	 */
+	if(ts->life == TRACE_LIFO || ts->pattern == TRACE_HOLES){
+	    k = count-1;
+	} else if(ts->life == TRACE_FIFO){
+	    k = 0;
+	} else {
+	    k = trace_rand(&state) % count;
+	}
+	ops[i].cmd = FREE_DATA;
+	ops[i].target = ring[(head+k) % ts->maxlive];
+	if(k == 0){
+	    head = (head+1) % ts->maxlive;
+	} else {
+	    ring[(head+k) % ts->maxlive] = ring[(head+count-1)
+						% ts->maxlive];
+	}
+	count--;
+    }
+    free(ring);
+    return ops;
+}
+
+/****************************************************************/
+
+/* write n generated commands out as input for this program.
+ */
+void
+write_trace(trace_op_t *ops, int n, int fd){
+    writer_t w;
+    int i, k;
+
+    open_writer(&w, fd);
+    for(i = 0; i<n; i++){
+	put_char(&w, ops[i].cmd);
+	if(ops[i].cmd == FREE_DATA){
+	    put_int(&w, ops[i].target+1);
+	} else if(ops[i].cmd == INPUT_CHARS){
+	    for(k = 1; k<ops[i].size; k++){
+		put_char(&w, 'a' + (i+k) % 26);
+	    }
+	} else {
+	    for(k = 0; k<ops[i].size/4; k++){
+		if(k > 0){
+		    put_char(&w, INT_DELIM_C);
+		}
+		put_char(&w, '1' + (i+k) % 9);
+	    }
+	}
+	put_char(&w, '\n');
+    }
+    flush_writer(&w);
+    free(w.buf);
+}
+
+/****************************************************************/
+
+/* order latencies for qsort().
+ */
+int
+compare_ns(const void *a, const void *b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/****************************************************************/
+
+/* replay n generated commands straight against mm_malloc() and mm_free(),
+ * timing each one, and print one tab separated line of results under a
+ * header: throughput, the median, 99th percentile and worst latency, the
+ * peak of live bytes, and the free space left at the end. fragmentation
+ * is 1 - largest free block / free space, at the end and at its worst
+ * over a hundred samples taken along the way.
+ */
+void
+bench_trace(trace_op_t *ops, int n){
+    void **ptrs = new_array(n, sizeof(*ptrs));
+    uint32_t *ns = new_array(n, sizeof(*ns));
+    struct timespec t0, t1, start, stop;
+    size_t live = 0, peak = 0, total, largest, holes;
+    double secs, frag, worst = 0, paused = 0;
+    long failed = 0;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i<n; i++){
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(ops[i].cmd != FREE_DATA){
+	    ptrs[i] = mm_malloc(manager, ops[i].size);
+	} else if(ptrs[ops[i].target] != NULL){
+	    mm_free(manager, ptrs[ops[i].target]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns[i] = (t1.tv_sec-t0.tv_sec)*1000000000L + (t1.tv_nsec-t0.tv_nsec);
+
+	if(ops[i].cmd != FREE_DATA && ptrs[i] == NULL){
+	    failed++;
+	} else if(ops[i].cmd != FREE_DATA){
+	    live += ops[i].size;
+	    peak = live > peak ? live : peak;
+	} else if(ptrs[ops[i].target] != NULL){
+	    live -= ops[ops[i].target].size;
+	    ptrs[ops[i].target] = NULL;
+	}
+
+	/* sampling is left out of the timings */
+	if(n >= 100 && i % (n/100) == 0){
+	    mm_free_stats(manager, &total, &largest, &holes);
+	    frag = total ? 1.0 - (double)largest/total : 0.0;
+	    worst = frag > worst ? frag : worst;
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    paused += (t0.tv_sec-t1.tv_sec) + (t0.tv_nsec-t1.tv_nsec)/1e9;
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    secs = (stop.tv_sec-start.tv_sec) + (stop.tv_nsec-start.tv_nsec)/1e9
+	- paused;
+    mm_free_stats(manager, &total, &largest, &holes);
+    frag = total ? 1.0 - (double)largest/total : 0.0;
+    qsort(ns, n, sizeof(*ns), compare_ns);
+
+    printf("policy\tops\tfailed\tseconds\tops/sec\tp50_ns\tp99_ns\tmax_ns"
+	   "\tpeak_live\tfree\tlargest_free\tholes\tfrag\tworst_frag\n");
+    printf("%s\t%d\t%ld\t%.3f\t%.0f\t%u\t%u\t%u\t%lu\t%lu\t%lu\t%lu"
+	   "\t%.3f\t%.3f\n", mm_policy_name(manager), n, failed, secs,
+	   n/secs, ns[n/2], ns[n - 1 - n/100], ns[n-1], (unsigned long)peak,
+	   (unsigned long)total, (unsigned long)largest,
+	   (unsigned long)holes, frag, worst > frag ? worst : frag);
+    free(ptrs);
+    free(ns);
+}
+
+/****************************************************************/
+
+/* at the end of the main function, all the resources stored in manger's memory
+ * is written to disk to the binary file with name filename_mem.
+ * some useful information on the stored resources are written to the
+ * text file named filename_vars (an integer 
+ * offset, an integer correspoinding to the size of the variable).
+ * what a restore needs besides goes to the text file named
+ * filename_cmds: a line with the number of commands run, then for each
+ * variable, in the same order, the number and type of the command in
+ * recs that stored it, the offset of its slab, 0 if it is in none, and
+ * the size of the slab's objects.
+ */
+void core_dump(char *filename_mem, char* filename_vars, char *filename_cmds,
+	       records_t *recs, int commands){
+	
+    /* open the filestreams with "w". memory may be a copy-on-write
+     * mapping of an old core_mem, which must not be truncated under it.
+     */
+    FILE* mem_fptr;
+    FILE* vars_fptr = fopen(filename_vars, "w");
+    FILE* cmds_fptr = fopen(filename_cmds, "w");
+    record_t **byHandle = records_by_handle(recs, mm_maxvars(manager));
+    size_t size, slab, object;
+    void *start;
+    int i;
+
+    unlink(filename_mem);
+    mem_fptr = fopen(filename_mem, "w");
+
+    fwrite(mm_memory(manager), 1, mm_size(manager), mem_fptr);
+	
+    fprintf(cmds_fptr, "commands\t%d\n", commands);
+    for(i = 0; i<mm_maxvars(manager); i++){
+	if((size = mm_var(manager, i, &start)) > 0){
+	    assert(byHandle[i] != NULL);
+	    fprintf(vars_fptr,"%d\t",
+	    	    (int)((char*)start-mm_memory(manager)));
+	    fprintf(vars_fptr,"%d\n", (int)size);
+	    slab = mm_var_slab(manager, i, &object);
+	    fprintf(cmds_fptr, "%d\t%c\t%d\t%d\n", byHandle[i]->cmd,
+		    byHandle[i]->type, (int)slab, (int)object);
+	}
+    }
+    fclose(mem_fptr);
+    fclose(vars_fptr);
+    fclose(cmds_fptr);
+    free(byHandle);
+}
+
+/****************************************************************/
+
+/* store the low n bytes of v at p, least significant first, so that
+ * dumps read the same on any machine.
+ */
+void
+put_le(unsigned char *p, uint64_t v, int n){
+    int i;
+    for(i = 0; i<n; i++){
+	p[i] = (unsigned char)(v >> (8*i));
+    }
+}
+
+/****************************************************************/
+
+/* read back n bytes stored by put_le().
+ */
+uint64_t
+get_le(unsigned char *p, int n){
+    uint64_t v = 0;
+    while(n-- > 0){
+	v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+/****************************************************************/
+
+/* run-length encode len bytes of src into dst, which must have room for
+ * len bytes. A control byte c below 128 is followed by c+1 literal bytes;
+ * from 128 up it is followed by one byte to repeat c-126 times. returns
+ * the encoded length, or len when encoding would not save anything.
+ */
+size_t
+rle_encode(unsigned char *src, size_t len, unsigned char *dst){
+    size_t i = 0, run, lit, out = 0;
+    while(i < len){
+	for(run = 1; i+run < len && run < 129 && src[i+run] == src[i]; run++);
+	if(run >= 2){
+	    if(out+2 >= len){
+		return len;
+	    }
+	    dst[out++] = (unsigned char)(run+126);
+	    dst[out++] = src[i];
+	    i += run;
+	    continue;
+	}
+	/* literals last until the next run of two or more */
+	for(lit = 1; i+lit < len && lit < 128 && !(i+lit+1 < len
+	    && src[i+lit] == src[i+lit+1]); lit++);
+	if(out+1+lit >= len){
+	    return len;
+	}
+	dst[out++] = (unsigned char)(lit-1);
+	memcpy(dst+out, src+i, lit);
+	out += lit;
+	i += lit;
+    }
+    return out;
+}
+
+/****************************************************************/
+
+/* undo rle_encode(): decode len bytes of src into exactly size bytes of
+ * dst. returns ERROR if src does not decode to size bytes.
+ */
+int
+rle_decode(unsigned char *src, size_t len, unsigned char *dst, size_t size){
+    size_t i = 0, out = 0, n;
+    while(i < len){
+	if(src[i] < 128){
+	    n = src[i] + 1;
+	    if(i+1+n > len || out+n > size){
+		return ERROR;
+	    }
+	    memcpy(dst+out, src+i+1, n);
+	    i += 1+n;
+	} else {
+	    n = src[i] - 126;
+	    if(i+1 >= len || out+n > size){
+		return ERROR;
+	    }
+	    memset(dst+out, src[i+1], n);
+	    i += 2;
+	}
+	out += n;
+    }
+    return out == size ? SUCCESS : ERROR;
+}
+
+/****************************************************************/
+
+/* like core_dump(), but only the live variables are written, to a single
+ * binary file: a header, the bytes of each variable (run-length encoded
+ * when compress is set and that makes them smaller), then a table with
+ * the index, offset and size of each variable in index order, the
+ * number and type of the command in recs that stored it, and the offset
+ * of its slab and the size of the slab's objects. I/O is in
+ * proportion to the live data rather than to the size of memory.
+ */
+void
+sparse_dump(char *filename, int compress, records_t *recs, int commands){
+    FILE *fp = fopen(filename, "wb");
+    unsigned char header[SPARSE_HEADER], entry[SPARSE_ENTRY];
+    unsigned char *table, *packed = NULL, *data;
+    size_t at = SPARSE_HEADER, len, size, maxsize = 0, object;
+    record_t **byHandle;
+    void *start;
+    int i, n = 0, encoding;
+
+    if(!fp){
+	perror(filename);
+	give_up();
+    }
+    for(i = 0; i<mm_maxvars(manager); i++){
+	if((size = mm_var(manager, i, &start)) > maxsize){
+	    maxsize = size;
+	}
+    }
+    table = new_array(mm_maxvars(manager), SPARSE_ENTRY);
+    if(compress){
+	packed = new_array(maxsize, 1);
+    }
+    byHandle = records_by_handle(recs, mm_maxvars(manager));
+
+    /* the header is written again once the table's position is known */
+    fwrite(header, 1, SPARSE_HEADER, fp);
+    for(i = 0; i<mm_maxvars(manager); i++){
+	if((size = mm_var(manager, i, &start)) == 0){
+	    continue;
+	}
+	data = start;
+	len = size;
+	encoding = SPARSE_RAW;
+	if(compress && (len = rle_encode(data, len, packed)) < size){
+	    data = packed;
+	    encoding = SPARSE_RLE;
+	}
+	fwrite(data, 1, len, fp);
+
+	put_le(entry, i, 4);
+	put_le(entry+4, encoding, 4);
+	put_le(entry+8, (char *)start - mm_memory(manager), 8);
+	put_le(entry+16, size, 8);
+	put_le(entry+24, at, 8);
+	put_le(entry+32, len, 8);
+	assert(byHandle[i] != NULL);
+	put_le(entry+40, byHandle[i]->cmd, 4);
+	put_le(entry+44, byHandle[i]->type, 4);
+	put_le(entry+48, mm_var_slab(manager, i, &object), 8);
+	put_le(entry+56, object, 8);
+	memcpy(table + (size_t)n*SPARSE_ENTRY, entry, SPARSE_ENTRY);
+	at += len;
+	n++;
+    }
+    fwrite(table, SPARSE_ENTRY, n, fp);
+
+    memcpy(header, SPARSE_MAGIC, 8);
+    put_le(header+8, SPARSE_VERSION, 4);
+    put_le(header+12, n, 4);
+    put_le(header+16, mm_size(manager), 8);
+    put_le(header+24, at, 8);
+    put_le(header+32, commands, 8);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(header, 1, SPARSE_HEADER, fp);
+    if(fclose(fp) != 0){
+	perror(filename);
+	give_up();
+    }
+    free(table);
+    free(packed);
+    free(byHandle);
+}
+
+/****************************************************************/
+
+/* read the header of the sparse dump fp, named filename, into header,
+ * and return the version of the dump. dumps from before command numbers
+ * were kept cannot be restored from, and end the program like anything
+ * else that is not a sparse dump.
+ */
+int
+sparse_header(FILE *fp, char *filename, unsigned char *header){
+    size_t got = fp ? fread(header, 1, SPARSE_HEADER, fp) : 0;
+    int version = got >= 12 ? (int)get_le(header+8, 4) : 0;
+
+    if(got < 12 || memcmp(header, SPARSE_MAGIC, 8) != 0){
+	fprintf(stderr, "%s is not a sparse core dump.\n", filename);
+	give_up();
+    }
+    if(version < 2 || version > SPARSE_VERSION){
+	fprintf(stderr, "%s is a sparse dump of version %d, which cannot "
+		"be read.\n", filename, version);
+	give_up();
+    }
+    if(got != SPARSE_HEADER){
+	fprintf(stderr, "%s is truncated.\n", filename);
+	give_up();
+    }
+    return version;
+}
+
+/****************************************************************/
+
+/* read a dump written by sparse_dump() and call put(v, arg) for each
+ * variable v, in index order, with its data decoded. returns the size
+ * of memory it was taken from, with the number of commands run before
+ * it in *commands; a file that is not a valid sparse dump ends the
+ * program. the variables of a version 2 dump, from before slabs were
+ * kept, are in none.
+ */
+size_t
+read_sparse(char *filename, void (*put)(dump_var_t *v, void *arg),
+	    void *arg, int *commands){
+    FILE *fp = fopen(filename, "rb");
+    unsigned char header[SPARSE_HEADER], *table, *entry;
+    unsigned char *packed = NULL, *data = NULL;
+    size_t totalmem, size, len, offset, width;
+    dump_var_t v;
+    int n, k, version;
+
+    if(!fp){
+	perror(filename);
+	give_up();
+    }
+    version = sparse_header(fp, filename, header);
+    width = version < 3 ? SPARSE_ENTRY_V2 : SPARSE_ENTRY;
+    n = get_le(header+12, 4);
+    totalmem = get_le(header+16, 8);
+    *commands = get_le(header+32, 8);
+    table = new_array(n, width);
+    if(fseek(fp, get_le(header+24, 8), SEEK_SET) != 0
+       || fread(table, width, n, fp) != (size_t)n){
+	fprintf(stderr, "%s is truncated.\n", filename);
+	give_up();
+    }
+
+    for(k = 0; k<n; k++){
+	entry = table + (size_t)k*width;
+	offset = get_le(entry+8, 8);
+	size = get_le(entry+16, 8);
+	len = get_le(entry+32, 8);
+	if(offset+size > totalmem || offset == 0){
+	    fprintf(stderr, "%s has a variable outside memory.\n", filename);
+	    give_up();
+	}
+	packed = realloc(packed, len ? len : 1);
+	data = realloc(data, size ? size : 1);
+	if(!packed || !data){
+	    fprintf(stderr, "Out of memory.\n");
+	    give_up();
+	}
+	if(fseek(fp, get_le(entry+24, 8), SEEK_SET) != 0
+	   || fread(packed, 1, len, fp) != len
+	   || (get_le(entry+4, 4) == SPARSE_RLE
+	       ? rle_decode(packed, len, data, size) == ERROR
+	       : len != size)){
+	    fprintf(stderr, "%s has a damaged variable.\n", filename);
+	    give_up();
+	}
+	v.offset = offset;
+	v.size = size;
+	v.cmd = get_le(entry+40, 4);
+	v.type = get_le(entry+44, 4);
+	v.slab = version < 3 ? 0 : get_le(entry+48, 8);
+	v.object = version < 3 ? 0 : get_le(entry+56, 8);
+	v.data = get_le(entry+4, 4) == SPARSE_RLE ? data : packed;
+	put(&v, arg);
+    }
+    fclose(fp);
+    free(table);
+    free(packed);
+    free(data);
+    return totalmem;
+}
+
+/****************************************************************/
+
+/* copy one variable of a sparse dump into the image of memory at arg,
+ * remembering it for core_vars and core_cmds.
+ */
+void
+expand_var(dump_var_t *v, void *arg){
+    expand_t *x = arg;
+    memcpy(x->memory + v->offset, v->data, v->size);
+    fprintf(x->vars_fptr, "%d\t%d\n", (int)v->offset, (int)v->size);
+    fprintf(x->cmds_fptr, "%d\t%c\t%d\t%d\n", v->cmd, v->type,
+	    (int)v->slab, (int)v->object);
+}
+
+/****************************************************************/
+
+/* turn a sparse dump back into the core_mem, core_vars and core_cmds
+ * that core_dump() writes. bytes no live variable covers come out as
+ * zero.
+ */
+void
+expand_sparse(char *filename, char *filename_mem, char *filename_vars,
+	      char *filename_cmds){
+    FILE *fp = fopen(filename, "rb");
+    unsigned char header[SPARSE_HEADER];
+    FILE *mem_fptr;
+    expand_t x;
+    size_t totalmem;
+    int commands;
+
+    /* the size of memory is needed before any variable is copied */
+    sparse_header(fp, filename, header);
+    fclose(fp);
+    totalmem = get_le(header+16, 8);
+    x.memory = new_array(totalmem, 1);
+    x.vars_fptr = fopen(filename_vars, "w");
+    x.cmds_fptr = fopen(filename_cmds, "w");
+    mem_fptr = fopen(filename_mem, "w");
+    if(!x.vars_fptr || !x.cmds_fptr || !mem_fptr){
+	perror("core dump");
+	exit(EXIT_FAILURE);
+    }
+    fprintf(x.cmds_fptr, "commands\t%d\n", (int)get_le(header+32, 8));
+    read_sparse(filename, expand_var, &x, &commands);
+    fwrite(x.memory, 1, totalmem, mem_fptr);
+    fclose(mem_fptr);
+    fclose(x.vars_fptr);
+    fclose(x.cmds_fptr);
+    free(x.memory);
+}
+
+/****************************************************************/
+
+/* make mm at least size bytes long, giving up if memory cannot grow.
+ */
+void
+fit_memory(mmanager_t *mm, size_t size, char *filename){
+    while(mm_size(mm) < size
+	  && mm_grow(mm, size - mm_size(mm)) == SUCCESS);
+    if(mm_size(mm) < size){
+	fprintf(stderr, "%s does not fit in memory.\n", filename);
+	give_up();
+    }
+}
+
+/****************************************************************/
+
+/* load the core_mem and core_vars written by core_dump() back into a
+ * freshly set up mm, and the records of the variables, from core_cmds,
+ * into job. core_mem is mapped copy-on-write straight onto memory when
+ * it is a whole number of pages, so only the pages that are touched are
+ * ever read; otherwise it is read in.
+ */
+void
+load_core(mmanager_t *mm, job_t *job, char *filename_mem,
+	  char *filename_vars, char *filename_cmds){
+    int fd = open(filename_mem, O_RDONLY), cmd;
+    FILE *vars_fptr = fopen(filename_vars, "r");
+    FILE *cmds_fptr = fopen(filename_cmds, "r");
+    size_t size, done = 0;
+    long offset, len, slab, object;
+    struct stat st;
+    restore_t r;
+    ssize_t got;
+    char type;
+
+    if(fd < 0 || !vars_fptr || !cmds_fptr || fstat(fd, &st) != 0){
+	perror(fd < 0 || fstat(fd, &st) != 0 ? filename_mem
+	       : !vars_fptr ? filename_vars : filename_cmds);
+	give_up();
+    }
+    size = st.st_size;
+    fit_memory(mm, size, filename_mem);
+    if(size == 0 || size % PAGESIZE != 0
+       || mmap(mm_memory(mm), size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+	while(done < size && (got = read(fd, mm_memory(mm) + done,
+					 size - done)) > 0){
+	    done += got;
+	}
+	if(done < size){
+	    perror(filename_mem);
+	    give_up();
+	}
+    }
+    close(fd);
+
+    /* core_cmds has a line for each of core_vars, after its first */
+    new_restore(&r, mm);
+    if(fscanf(cmds_fptr, "commands %d", &r.commands) != 1){
+	fprintf(stderr, "%s is not a list of commands.\n", filename_cmds);
+	give_up();
+    }
+    while(r.n <= mm_maxvars(mm)
+	  && fscanf(vars_fptr, "%ld %ld", &offset, &len) == 2){
+	if(fscanf(cmds_fptr, "%d %c %ld %ld", &cmd, &type, &slab,
+		  &object) != 4){
+	    fprintf(stderr, "%s does not match %s.\n", filename_cmds,
+		    filename_vars);
+	    give_up();
+	}
+	r.offsets[r.n] = offset < 0 ? 0 : offset;
+	r.sizes[r.n] = len < 0 ? 0 : len;
+	r.slabs[r.n] = slab < 0 ? 0 : slab;
+	r.objects[r.n] = object < 0 ? 0 : object;
+	r.cmds[r.n] = cmd;
+	r.types[r.n++] = type;
+    }
+    if(!feof(vars_fptr) && r.n <= mm_maxvars(mm)){
+	fprintf(stderr, "%s is not a list of variables.\n", filename_vars);
+	give_up();
+    }
+    if(r.n <= mm_maxvars(mm) && fscanf(cmds_fptr, " %c", &type) != EOF){
+	fprintf(stderr, "%s does not match %s.\n", filename_cmds,
+		filename_vars);
+	give_up();
+    }
+    fclose(vars_fptr);
+    fclose(cmds_fptr);
+    finish_restore(&r, job, filename_vars);
+}
+
+/****************************************************************/
+
+/* copy one variable of a sparse dump into the memory of the manager being
+ * restored, remembering where it is and what stored it.
+ */
+void
+restore_var(dump_var_t *v, void *arg){
+    restore_t *r = arg;
+    if(r->n > mm_maxvars(r->mm)){
+	return;
+    }
+    fit_memory(r->mm, v->offset+v->size, "core_sparse");
+    memcpy(mm_memory(r->mm) + v->offset, v->data, v->size);
+    r->offsets[r->n] = v->offset;
+    r->sizes[r->n] = v->size;
+    r->slabs[r->n] = v->slab;
+    r->objects[r->n] = v->object;
+    r->cmds[r->n] = v->cmd;
+    r->types[r->n++] = v->type;
+}
+
+/****************************************************************/
+
+/* like load_core(), but from a dump written by sparse_dump().
+ */
+void
+load_sparse(mmanager_t *mm, job_t *job, char *filename){
+    restore_t r;
+    new_restore(&r, mm);
+    read_sparse(filename, restore_var, &r, &r.commands);
+    finish_restore(&r, job, filename);
+}
+
+/****************************************************************/
+
+/* get r ready to collect the variables of a dump, for mm.
+ */
+void
+new_restore(restore_t *r, mmanager_t *mm){
+    r->mm = mm;
+    r->n = 0;
+    r->commands = 0;
+    r->offsets = new_array(mm_maxvars(mm)+1, sizeof(*r->offsets));
+    r->sizes = new_array(mm_maxvars(mm)+1, sizeof(*r->sizes));
+    r->slabs = new_array(mm_maxvars(mm)+1, sizeof(*r->slabs));
+    r->objects = new_array(mm_maxvars(mm)+1, sizeof(*r->objects));
+    r->cmds = new_array(mm_maxvars(mm)+1, sizeof(*r->cmds));
+    r->types = new_array(mm_maxvars(mm)+1, 1);
+}
+
+/****************************************************************/
+
+/* put back the variables collected in r, from the dump named filename:
+ * into r->mm, aligned as the commands that stored them would have them,
+ * and into the records of job, whose command numbers carry on from those
+ * of the dump. a variable that no command could have stored, or that
+ * does not fit, ends the job, as does a dump with slabs when r->mm does
+ * not use them.
+ */
+void
+finish_restore(restore_t *r, job_t *job, char *filename){
+    size_t *aligns = new_array(r->n, sizeof(*aligns));
+    records_t *recs = &job->recs;
+    int i, bad = r->commands < 0;
+
+    for(i = 0; i<r->n; i++){
+	if(r->slabs[i] && !mm_slabs(r->mm)){
+	    fprintf(stderr, "%s holds slabs, which only a run with -c can "
+		    "restore.\n", filename);
+	    give_up();
+	}
+	bad |= (r->types[i] != INPUT_CHARS && r->types[i] != INPUT_INTS)
+	    || r->cmds[i] < 0 || r->cmds[i] >= r->commands
+	    || (r->types[i] == INPUT_INTS && r->sizes[i] % sizeof(int));
+	aligns[i] = r->types[i] == INPUT_INTS ? int_align : 1;
+	add_record(recs, r->cmds[i], r->types[i], i,
+		   r->types[i] == INPUT_CHARS ? (int)r->sizes[i]
+		   : (int)(r->sizes[i] / sizeof(int)));
+    }
+    qsort(recs->recs, recs->n, sizeof(*recs->recs), compare_records);
+    for(i = 1; i<recs->n; i++){
+	bad |= recs->recs[i].cmd == recs->recs[i-1].cmd;
+    }
+    if(bad || mm_restore(r->mm, r->offsets, r->sizes, aligns, r->slabs,
+			 r->objects, r->n) == ERROR){
+	fprintf(stderr, "%s does not describe variables that fit.\n",
+		filename);
+	give_up();
+    }
+    job->commands = r->commands;
+    free(aligns);
+    free(r->offsets);
+    free(r->sizes);
+    free(r->slabs);
+    free(r->objects);
+    free(r->cmds);
+    free(r->types);
+}
+
+/****************************************************************/
+
+/* start a log of checkpoints for job, appending to the file named with
+ * prefix, and have this thread's manager keep track of what changes.
+ */
+void
+open_log(settings_t *set, job_t *job, char *prefix){
+    char name[PATH_MAX];
+    if(!(job->log = fopen(dump_name(name, prefix, "core_log"), "ab"))){
+	perror(name);
+	give_up();
+    }
+    job->every = set->every;
+    job->signals = checkpoint_signals;
+    if(mm_track_dirty(manager, 1) == ERROR){
+	fprintf(stderr, "Out of memory.\n");
+	give_up();
+    }
+}
+
+/****************************************************************/
+
+/* append a checkpoint of this thread's manager to job's log, holding the
+ * pages of memory and the variables that have changed since the last.
+ * the first of a run holds everything.
+ */
+void
+checkpoint(job_t *job){
+    record_t **byHandle;
+    checkpoint_t c;
+    size_t off = 0, len, size;
+    void *start;
+    int i = 0;
+
+    c.full = job->checkpoints++ == 0;
+    c.commands = job->commands;
+    c.maxvars = mm_maxvars(manager);
+    c.totalmem = mm_size(manager);
+    c.memory = mm_memory(manager);
+    c.runs = new_array(2*(c.totalmem/PAGESIZE+1), sizeof(*c.runs));
+    c.vars = new_array(c.maxvars, sizeof(*c.vars));
+    c.offsets = new_array(c.maxvars, sizeof(*c.offsets));
+    c.sizes = new_array(c.maxvars, sizeof(*c.sizes));
+    c.slabs = new_array(c.maxvars, sizeof(*c.slabs));
+    c.objects = new_array(c.maxvars, sizeof(*c.objects));
+    c.cmds = new_array(c.maxvars, sizeof(*c.cmds));
+    c.types = new_array(c.maxvars, 1);
+    c.nruns = c.nvars = 0;
+    byHandle = records_by_handle(&job->recs, c.maxvars);
+
+    while((len = mm_next_dirty(manager, &off)) > 0){
+	add_run(&c, off, len);
+	off += len;
+    }
+    for(; (i = mm_next_dirty_var(manager, i)) != ERROR; i++){
+	/* a full checkpoint starts from no variables at all */
+	if((size = mm_var(manager, i, &start)) > 0 || !c.full){
+	    c.vars[c.nvars] = i;
+	    c.offsets[c.nvars] = size > 0 ? (char *)start - mm_memory(manager)
+		: 0;
+	    c.slabs[c.nvars] = mm_var_slab(manager, i, c.objects + c.nvars);
+	    c.cmds[c.nvars] = size > 0 ? byHandle[i]->cmd : ERROR;
+	    c.types[c.nvars] = size > 0 ? byHandle[i]->type : 0;
+	    c.sizes[c.nvars++] = size;
+	}
+    }
+    write_checkpoint(job->log, &c, "core_log");
+    free(c.runs);
+    free(c.vars);
+    free(c.offsets);
+    free(c.sizes);
+    free(c.slabs);
+    free(c.objects);
+    free(c.cmds);
+    free(c.types);
+    free(byHandle);
+}
+
+/****************************************************************/
+
+/* add the len bytes of memory from off to the runs of c. a full
+ * checkpoint is replayed onto zeroed memory, so pages of it that are all
+ * zero are left out.
+ */
+void
+add_run(checkpoint_t *c, size_t off, size_t len){
+    size_t end = off+len;
+    char *page;
+
+    if(!c->full){
+	c->runs[2*c->nruns] = off;
+	c->runs[2*c->nruns++ + 1] = len;
+	return;
+    }
+    for(; off < end; off += PAGESIZE){
+	page = c->memory + off;
+	if(page[0] == 0 && memcmp(page, page+1, PAGESIZE-1) == 0){
+	    continue;
+	}
+	if(c->nruns > 0
+	   && c->runs[2*c->nruns-2] + c->runs[2*c->nruns-1] == off){
+	    c->runs[2*c->nruns-1] += PAGESIZE;
+	} else {
+	    c->runs[2*c->nruns] = off;
+	    c->runs[2*c->nruns++ + 1] = PAGESIZE;
+	}
+    }
+}
+
+/****************************************************************/
+
+/* append checkpoint c to the log fp, named filename: a header, each run
+ * of memory with its offset and length in front of it, then the index,
+ * offset and size of each variable, the number and type of the command
+ * that stored it, and the offset of its slab and the size of the slab's
+ * objects. the header holds the length of the whole, so
+ * that one cut short can be told apart.
+ */
+void
+write_checkpoint(FILE *fp, checkpoint_t *c, char *filename){
+    unsigned char header[LOG_HEADER], entry[LOG_RUN+LOG_VAR];
+    size_t length = LOG_HEADER + (size_t)c->nvars*LOG_VAR;
+    int k;
+
+    for(k = 0; k<c->nruns; k++){
+	length += LOG_RUN + c->runs[2*k+1];
+    }
+    memcpy(header, LOG_MAGIC, 8);
+    put_le(header+8, LOG_VERSION, 4);
+    put_le(header+12, c->full, 4);
+    put_le(header+16, c->commands, 4);
+    put_le(header+20, c->maxvars, 4);
+    put_le(header+24, c->nruns, 4);
+    put_le(header+28, c->nvars, 4);
+    put_le(header+32, c->totalmem, 8);
+    put_le(header+40, length, 8);
+    fwrite(header, 1, LOG_HEADER, fp);
+    for(k = 0; k<c->nruns; k++){
+	put_le(entry, c->runs[2*k], 8);
+	put_le(entry+8, c->runs[2*k+1], 8);
+	fwrite(entry, 1, LOG_RUN, fp);
+	fwrite(c->memory + c->runs[2*k], 1, c->runs[2*k+1], fp);
+    }
+    for(k = 0; k<c->nvars; k++){
+	put_le(entry, c->vars[k], 4);
+	put_le(entry+4, c->offsets[k], 8);
+	put_le(entry+12, c->sizes[k], 8);
+	put_le(entry+20, c->cmds[k], 4);
+	put_le(entry+24, c->types[k], 4);
+	put_le(entry+28, c->slabs[k], 8);
+	put_le(entry+36, c->objects[k], 8);
+	fwrite(entry, 1, LOG_VAR, fp);
+    }
+    if(fflush(fp) != 0 || ferror(fp)){
+	perror(filename);
+	give_up();
+    }
+}
+
+/****************************************************************/
+
+/* replay every checkpoint of the log named filename into s, which starts
+ * out empty. a checkpoint cut short at the end of the log, as it would be
+ * if the run that wrote it died, is left out; anything else that is
+ * wrong with the log ends the program. the variables of a version 2
+ * checkpoint, from before slabs were kept, are in none.
+ */
+void
+replay_log(char *filename, log_state_t *s){
+    FILE *fp = fopen(filename, "rb");
+    unsigned char header[LOG_HEADER], entry[LOG_RUN+LOG_VAR];
+    size_t at = 0, size, length, totalmem, off, len, width;
+    int full, maxvars, nruns, nvars, k, i, n = 0, version;
+    struct stat st;
+
+    memset(s, 0, sizeof(*s));
+    s->memory = new_array(0, 1);
+    s->offsets = new_array(0, sizeof(*s->offsets));
+    s->sizes = new_array(0, sizeof(*s->sizes));
+    s->slabs = new_array(0, sizeof(*s->slabs));
+    s->objects = new_array(0, sizeof(*s->objects));
+    s->cmds = new_array(0, sizeof(*s->cmds));
+    s->types = new_array(0, 1);
+    if(!fp || fstat(fileno(fp), &st) != 0){
+	perror(filename);
+	exit(EXIT_FAILURE);
+    }
+    size = st.st_size;
+    while(at < size){
+	if(size-at < LOG_HEADER
+	   || fread(header, 1, LOG_HEADER, fp) != LOG_HEADER
+	   || (memcmp(header, LOG_MAGIC, 8) == 0
+	       && (length = get_le(header+40, 8)) > size-at)){
+	    fprintf(stderr, "%s ends in a checkpoint cut short, which is "
+		    "left out.\n", filename);
+	    break;
+	}
+	version = get_le(header+8, 4);
+	if(memcmp(header, LOG_MAGIC, 8) == 0
+	   && (version < 2 || version > LOG_VERSION)){
+	    fprintf(stderr, "%s has a checkpoint of version %d, which "
+		    "cannot be read.\n", filename, version);
+	    exit(EXIT_FAILURE);
+	}
+
+	/* a run may have appended to the log of an older one */
+	width = version < 3 ? LOG_VAR_V2 : LOG_VAR;
+	full = get_le(header+12, 4);
+	maxvars = get_le(header+20, 4);
+	nruns = get_le(header+24, 4);
+	nvars = get_le(header+28, 4);
+	totalmem = get_le(header+32, 8);
+	if(memcmp(header, LOG_MAGIC, 8) != 0
+	   || (length = get_le(header+40, 8)) > size-at
+	   || length < LOG_HEADER + (size_t)nruns*LOG_RUN
+	   + (size_t)nvars*width || maxvars < 0 || nvars > maxvars){
+	    fprintf(stderr, "%s has a damaged checkpoint.\n", filename);
+	    exit(EXIT_FAILURE);
+	}
+
+	/* memory and the variables only ever grow, up to a full one */
+	if(totalmem > s->cap){
+	    s->memory = grow_array(s->memory, s->cap, totalmem, 1);
+	    s->cap = totalmem;
+	}
+	if(maxvars > s->maxvars){
+	    s->offsets = grow_array(s->offsets, s->maxvars, maxvars,
+				       sizeof(*s->offsets));
+	    s->sizes = grow_array(s->sizes, s->maxvars, maxvars,
+				     sizeof(*s->sizes));
+	    s->slabs = grow_array(s->slabs, s->maxvars, maxvars,
+				     sizeof(*s->slabs));
+	    s->objects = grow_array(s->objects, s->maxvars, maxvars,
+				       sizeof(*s->objects));
+	    s->cmds = grow_array(s->cmds, s->maxvars, maxvars,
+				    sizeof(*s->cmds));
+	    s->types = grow_array(s->types, s->maxvars, maxvars, 1);
+	    s->maxvars = maxvars;
+	}
+	if(full){
+	    memset(s->memory, 0, s->cap);
+	    memset(s->sizes, 0, s->maxvars*sizeof(*s->sizes));
+	}
+	s->totalmem = totalmem;
+	s->commands = get_le(header+16, 4);
+
+	for(k = 0; k<nruns; k++){
+	    if(fread(entry, 1, LOG_RUN, fp) != LOG_RUN
+	       || (off = get_le(entry, 8)) > totalmem
+	       || (len = get_le(entry+8, 8)) > totalmem-off
+	       || fread(s->memory + off, 1, len, fp) != len){
+		fprintf(stderr, "%s has a damaged checkpoint.\n", filename);
+		exit(EXIT_FAILURE);
+	    }
+	}
+	for(k = 0; k<nvars; k++){
+	    /* what an older entry lacks reads as 0, in no slab */
+	    memset(entry, 0, sizeof(entry));
+	    if(fread(entry, 1, width, fp) != width
+	       || (i = get_le(entry, 4)) < 0 || i >= maxvars
+	       || (off = get_le(entry+4, 8)) > totalmem
+	       || (len = get_le(entry+12, 8)) > totalmem-off
+	       || get_le(entry+28, 8) > totalmem){
+		fprintf(stderr, "%s has a damaged checkpoint.\n", filename);
+		exit(EXIT_FAILURE);
+	    }
+	    s->offsets[i] = off;
+	    s->sizes[i] = len;
+	    s->cmds[i] = get_le(entry+20, 4);
+	    s->types[i] = get_le(entry+24, 4);
+	    s->slabs[i] = get_le(entry+28, 8);
+	    s->objects[i] = get_le(entry+36, 8);
+	}
+	if((size_t)ftell(fp) != at + length){
+	    fprintf(stderr, "%s has a damaged checkpoint.\n", filename);
+	    exit(EXIT_FAILURE);
+	}
+	at += length;
+	n++;
+    }
+    fclose(fp);
+    if(n == 0){
+	fprintf(stderr, "%s holds no checkpoint.\n", filename);
+	exit(EXIT_FAILURE);
+    }
+}
+
+/****************************************************************/
+
+/* rebuild the core_mem, core_vars and core_cmds that a run would have
+ * dumped when it wrote the last checkpoint of the log named filename.
+ */
+void
+expand_log(char *filename, char *filename_mem, char *filename_vars,
+	   char *filename_cmds){
+    FILE *mem_fptr, *vars_fptr, *cmds_fptr;
+    log_state_t s;
+    int i;
+
+    replay_log(filename, &s);
+    mem_fptr = fopen(filename_mem, "w");
+    vars_fptr = fopen(filename_vars, "w");
+    cmds_fptr = fopen(filename_cmds, "w");
+    if(!mem_fptr || !vars_fptr || !cmds_fptr){
+	perror("core dump");
+	exit(EXIT_FAILURE);
+    }
+    fwrite(s.memory, 1, s.totalmem, mem_fptr);
+    fprintf(cmds_fptr, "commands\t%d\n", s.commands);
+    for(i = 0; i<s.maxvars; i++){
+	if(s.sizes[i] > 0){
+	    fprintf(vars_fptr, "%d\t%d\n", (int)s.offsets[i],
+		    (int)s.sizes[i]);
+	    fprintf(cmds_fptr, "%d\t%c\t%d\t%d\n", s.cmds[i], s.types[i],
+		    (int)s.slabs[i], (int)s.objects[i]);
+	}
+    }
+    fclose(mem_fptr);
+    fclose(vars_fptr);
+    fclose(cmds_fptr);
+    free_log_state(&s);
+}
+
+/****************************************************************/
+
+/* replace the log named filename with a single full checkpoint of what
+ * it replays to. the new log is written beside it and renamed over it,
+ * so the old one stays whole until the new one is.
+ */
+void
+compact_log(char *filename){
+    char name[PATH_MAX];
+    checkpoint_t c;
+    log_state_t s;
+    FILE *fp;
+    int i;
+
+    replay_log(filename, &s);
+    c.full = 1;
+    c.commands = s.commands;
+    c.maxvars = s.maxvars;
+    c.totalmem = s.totalmem;
+    c.memory = s.memory;
+    c.runs = new_array(2*(s.totalmem/PAGESIZE+1), sizeof(*c.runs));
+    c.vars = new_array(s.maxvars, sizeof(*c.vars));
+    c.offsets = s.offsets;
+    c.sizes = s.sizes;
+    c.slabs = s.slabs;
+    c.objects = s.objects;
+    c.cmds = s.cmds;
+    c.types = s.types;
+    c.nruns = c.nvars = 0;
+    add_run(&c, 0, s.totalmem);
+
+    /* variables are packed to the front, where only live ones are kept */
+    for(i = 0; i<s.maxvars; i++){
+	if(s.sizes[i] > 0){
+	    c.vars[c.nvars] = i;
+	    c.offsets[c.nvars] = s.offsets[i];
+	    c.slabs[c.nvars] = s.slabs[i];
+	    c.objects[c.nvars] = s.objects[i];
+	    c.cmds[c.nvars] = s.cmds[i];
+	    c.types[c.nvars] = s.types[i];
+	    c.sizes[c.nvars++] = s.sizes[i];
+	}
+    }
+    dump_name(name, filename, ".tmp");
+    if(!(fp = fopen(name, "wb"))){
+	perror(name);
+	exit(EXIT_FAILURE);
+    }
+    write_checkpoint(fp, &c, name);
+    if(fclose(fp) != 0 || rename(name, filename) != 0){
+	perror(filename);
+	exit(EXIT_FAILURE);
+    }
+    free(c.runs);
+    free(c.vars);
+    free_log_state(&s);
+}
+
+/****************************************************************/
+
+/* give back what replay_log() took.
+ */
+void
+free_log_state(log_state_t *s){
+    free(s->memory);
+    free(s->offsets);
+    free(s->sizes);
+    free(s->slabs);
+    free(s->objects);
+    free(s->cmds);
+    free(s->types);
+}
+
+/****************************************************************/
+
+/* ask every run that keeps a log for a checkpoint once its current
+ * command is done.
+ */
+void
+checkpoint_signal(int sig){
+    (void)sig;
+    checkpoint_signals++;
+}
+
+#ifdef MM_STATS
+
+/****************************************************************/
+
+/* ask for the stats to be printed once the current command is done.
+ */
+void
+stats_signal(int sig){
+    (void)sig;
+    stats_wanted = 1;
 }
+#endif